@@ -0,0 +1,38 @@
+# Try to find EGL library (used for headless rendering without a window system)
+#
+unset( EGL_INCLUDE_DIR CACHE )
+unset( EGL_LIB CACHE )
+unset( EGL_FOUND CACHE )
+
+find_path( EGL_INCLUDE_DIR EGL/egl.h
+  ${EGL_LOCATION}/include
+  $ENV{EGL_LOCATION}/include
+  /usr/include
+  /usr/local/include
+)
+
+find_library( EGL_LIB EGL
+  ${EGL_LOCATION}/lib
+  $ENV{EGL_LOCATION}/lib
+  /usr/lib
+  /usr/lib/x86_64-linux-gnu
+  /usr/local/lib
+)
+
+if( EGL_INCLUDE_DIR AND EGL_LIB )
+  set( EGL_FOUND "YES" )
+  set( EGL_HEADERS "${EGL_INCLUDE_DIR}/EGL/egl.h" "${EGL_INCLUDE_DIR}/EGL/eglext.h" )
+else()
+  message( STATUS "
+    EGL not found, headless rendering will not be available.
+    The EGL folder you would specify with EGL_LOCATION should contain:
+    - lib folder: containing the libEGL.so
+    - include folder: containing the EGL/egl.h"
+  )
+endif()
+
+include( FindPackageHandleStandardArgs )
+
+find_package_handle_standard_args( EGL DEFAULT_MSG EGL_INCLUDE_DIR EGL_LIB )
+
+mark_as_advanced( EGL_FOUND )
@@ -11,6 +11,10 @@
 #else
 #   include <glxew.h>
 #endif
+#ifdef USEEGL
+#   include <EGL/egl.h>
+#   include <EGL/eglext.h>
+#endif
 #include <glfw3.h>
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -44,6 +48,7 @@ void compileShaders(void * = nullptr);
 #define PGR2_SHOW_MEMORY_STATISTICS 0x0F000001
 #define PGR2_DISABLE_VSYNC          0x0F000002
 #define PGR2_DISABLE_BUFFER_SWAP    0x0F000004
+#define PGR2_HEADLESS_FRAMES        0x0F000008  // value = number of offscreen frames (0 ... windowed mode)
 
 // INTERNAL USER CALLBACK FUNCTION POINTERS____________________________________
 namespace Callbacks {
@@ -412,6 +417,112 @@ void ShowMagnifier() {
     Tools::Texture::Show2DTexture(s_MagTexture, x1, y1, s_MagWindowResolution, s_MagWindowResolution, 0, true);
 }
 
+namespace Headless {
+#ifdef USEEGL
+    EGLDisplay Display          = EGL_NO_DISPLAY;
+    EGLContext Context          = EGL_NO_CONTEXT;
+    EGLSurface Surface          = EGL_NO_SURFACE;
+#endif
+    GLuint     Renderbuffers[2] = {0};  // Color and depth-stencil buffer of the offscreen "window"
+
+    //-----------------------------------------------------------------------------
+    // Name: CreateContext()
+    // Desc: Creates OpenGL context without a window system (EGL surfaceless,
+    //       pbuffer is used only if surfaceless contexts are not supported)
+    //-----------------------------------------------------------------------------
+    bool CreateContext(int major, int minor, int profile, bool debug) {
+#ifdef USEEGL
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay)
+            Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (Display == EGL_NO_DISPLAY)
+            Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if ((Display == EGL_NO_DISPLAY) || !eglInitialize(Display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API)) {
+            fprintf(stderr, "EGL error: unable to initialize display (0x%x)\n", eglGetError());
+            return false;
+        }
+
+        const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config      = nullptr;
+        EGLint    num_configs = 0;
+        if (!eglChooseConfig(Display, config_attribs, &config, 1, &num_configs) || (num_configs == 0))
+            eglChooseConfig(Display, &config_attribs[2], &config, 1, &num_configs);
+        if (num_configs == 0)
+            config = nullptr; // EGL_KHR_no_config_context
+
+        const EGLint context_attribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION,       major,
+            EGL_CONTEXT_MINOR_VERSION,       minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, (profile == GLFW_OPENGL_CORE_PROFILE) ? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+            EGL_CONTEXT_OPENGL_DEBUG,        debug ? EGL_TRUE : EGL_FALSE,
+            EGL_NONE
+        };
+        Context = eglCreateContext(Display, config, EGL_NO_CONTEXT, context_attribs);
+        if (Context == EGL_NO_CONTEXT) {
+            fprintf(stderr, "EGL error: unable to create OpenGL %d.%d context (0x%x)\n", major, minor, eglGetError());
+            return false;
+        }
+
+        // Everything is rendered into the offscreen FBO, pbuffer only makes the context current
+        const char* extensions = eglQueryString(Display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+            const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            Surface = eglCreatePbufferSurface(Display, config, pbuffer_attribs);
+        }
+        if (!eglMakeCurrent(Display, Surface, Surface, Context)) {
+            fprintf(stderr, "EGL error: unable to make context current (0x%x)\n", eglGetError());
+            return false;
+        }
+        fprintf(stderr, "Headless %s context created.\n", (Surface == EGL_NO_SURFACE) ? "surfaceless" : "pbuffer");
+        return true;
+#else
+        fprintf(stderr, "Error: headless mode requires EGL (USEEGL)\n");
+        return false;
+#endif
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: CreateFramebuffer()
+    // Desc: Creates offscreen FBO that replaces the window framebuffer
+    //-----------------------------------------------------------------------------
+    void CreateFramebuffer(const glm::ivec2& size) {
+        glDeleteFramebuffers(1, &Variables::Framebuffer);
+        glDeleteRenderbuffers(2, Renderbuffers);
+
+        glCreateRenderbuffers(2, Renderbuffers);
+        glNamedRenderbufferStorage(Renderbuffers[0], GL_RGBA8, size.x, size.y);
+        glNamedRenderbufferStorage(Renderbuffers[1], GL_DEPTH24_STENCIL8, size.x, size.y);
+
+        glCreateFramebuffers(1, &Variables::Framebuffer);
+        glNamedFramebufferRenderbuffer(Variables::Framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Renderbuffers[0]);
+        glNamedFramebufferRenderbuffer(Variables::Framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, Renderbuffers[1]);
+        glBindFramebuffer(GL_FRAMEBUFFER, Variables::Framebuffer);
+
+        const GLenum status = glCheckNamedFramebufferStatus(Variables::Framebuffer, GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+            fprintf(stderr, "Headless FBO creation failed, glCheckFramebufferStatus() = 0x%x\n", status);
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: DestroyContext()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void DestroyContext() {
+        glDeleteFramebuffers(1, &Variables::Framebuffer);
+        glDeleteRenderbuffers(2, Renderbuffers);
+        Variables::Framebuffer = 0;
+#ifdef USEEGL
+        eglMakeCurrent(Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (Surface != EGL_NO_SURFACE)
+            eglDestroySurface(Display, Surface);
+        eglDestroyContext(Display, Context);
+        eglTerminate(Display);
+#endif
+    }
+}; // end of namespace Headless
+
+
 //-----------------------------------------------------------------------------
 // Name: common_main()
 // Desc: 
@@ -444,14 +555,25 @@ int common_main(int window_width, int window_height, const char* window_title,
     bool bShowRotation     = false;
     bool bShowZOffset      = false;
     bool bAutoSwapDisabled = false;
+    int  contextVersion[2] = { 4, 0 };
+    int  contextProfile    = GLFW_OPENGL_ANY_PROFILE;
+
+    // Headless mode has to be known before GLFW is touched (there may be no display at all)
+    for (int* pConfig = opengl_config; pConfig && (*pConfig != 0); pConfig += 2) {
+        if (pConfig[0] == PGR2_HEADLESS_FRAMES)
+            Variables::HeadlessFrames = pConfig[1];
+    }
+    const bool bHeadless = (Variables::HeadlessFrames > 0);
 
     // Intialize GLFW
-    glfwSetErrorCallback(Callbacks::glfwError);
-    if (!glfwInit())
-        return 1;
+    if (!bHeadless) {
+        glfwSetErrorCallback(Callbacks::glfwError);
+        if (!glfwInit())
+            return 1;
+    }
 
     int* pConfig = opengl_config;
-    while (*pConfig != 0) {
+    while (pConfig && (*pConfig != 0)) {
         const int hint = *pConfig++;
         const int value = *pConfig++;
 
@@ -465,8 +587,17 @@ int common_main(int window_width, int window_height, const char* window_title,
         case PGR2_DISABLE_BUFFER_SWAP:
             bAutoSwapDisabled = (value == GL_TRUE);
             break;
+        case PGR2_HEADLESS_FRAMES:
+            break;
         default:
-            glfwWindowHint(hint, value);
+            if (!bHeadless)
+                glfwWindowHint(hint, value);
+            if (hint == GLFW_CONTEXT_VERSION_MAJOR)
+                contextVersion[0] = value;
+            if (hint == GLFW_CONTEXT_VERSION_MINOR)
+                contextVersion[1] = value;
+            if (hint == GLFW_OPENGL_PROFILE)
+                contextProfile = value;
             if (hint == GLFW_OPENGL_DEBUG_CONTEXT)
                 Variables::Debug = (value == GL_TRUE);
             if ((hint == GLFW_CONTEXT_VERSION_MAJOR) && (value < 4)) {
@@ -476,21 +607,36 @@ int common_main(int window_width, int window_height, const char* window_title,
         }
     }
 
-    // Create a window
-    Variables::Window = glfwCreateWindow(Variables::WindowSize.x, Variables::WindowSize.y, window_title, nullptr, nullptr);
-    if (!Variables::Window) {
-        fprintf(stderr, "Error: unable to create window\n");
-        return 3;
+    if (bHeadless) {
+        // Create a context without window, frames are rendered into an offscreen FBO
+        if (!Headless::CreateContext(contextVersion[0], contextVersion[1], contextProfile, Variables::Debug)) {
+            fprintf(stderr, "Error: unable to create headless context\n");
+            return 3;
+        }
+    } else {
+        // Create a window
+        Variables::Window = glfwCreateWindow(Variables::WindowSize.x, Variables::WindowSize.y, window_title, nullptr, nullptr);
+        if (!Variables::Window) {
+            fprintf(stderr, "Error: unable to create window\n");
+            return 3;
+        }
+        glfwSetWindowPos(Variables::Window, 100, 100);
+        glfwMakeContextCurrent(Variables::Window);
+        glfwSetInputMode(Variables::Window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
-    glfwSetWindowPos(Variables::Window, 100, 100);
-    glfwMakeContextCurrent(Variables::Window);
-    glfwSetInputMode(Variables::Window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 
     GLenum err = glewInit();
+#ifndef _WIN32
+    // GLX part of GLEW cannot be initialized without X display, GL entry points are loaded anyway
+    if (bHeadless && (err == GLEW_ERROR_NO_GLX_DISPLAY))
+        err = GLEW_OK;
+#endif
     if (err != GLEW_OK) {
         fprintf(stderr, "GLEW error: %s\n", glewGetErrorString(err));
         return 4;
     }
+    if (bHeadless)
+        Headless::CreateFramebuffer(Variables::WindowSize);
 
     // Print debug info
     fprintf(stderr, "VENDOR  : %s\nVERSION : %s\nRENDERER: %s\nGLSL    : %s\n", glGetString(GL_VENDOR),
@@ -500,19 +646,21 @@ int common_main(int window_width, int window_height, const char* window_title,
     fprintf(stderr, "-------------------------------------------------------------------------------\n");
     
     // Init GUI
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImPlot::CreateContext();
-
-    ImGui::GetIO();
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(Variables::Window, true);
-    ImGui_ImplOpenGL3_Init("#version 400");
-    //io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
-    //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+    if (!bHeadless) {
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImPlot::CreateContext();
+
+        ImGui::GetIO();
+        ImGui::StyleColorsDark();
+        ImGui_ImplGlfw_InitForOpenGL(Variables::Window, true);
+        ImGui_ImplOpenGL3_Init("#version 400");
+        //io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
+        //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+    }
 
     // Enable OGL debug 
-    if (Variables::Debug && glfwExtensionSupported("GL_ARB_debug_output")) {
+    if (Variables::Debug && glewIsSupported("GL_ARB_debug_output")) {
         glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
         glDebugMessageCallback(Callbacks::PrintOGLDebugLog, nullptr);
         glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
@@ -521,7 +669,9 @@ int common_main(int window_width, int window_height, const char* window_title,
         Variables::Debug = false;
 
     // Disable VSync if required
-    if (bDisableVSync) {
+    if (bHeadless)
+        fprintf(stderr, "Headless mode, %d frames will be rendered.\n", Variables::HeadlessFrames);
+    else if (bDisableVSync) {
         glfwSwapInterval(0);
         fprintf(stderr, "VSync is disabled.\n");
     }
@@ -530,7 +680,7 @@ int common_main(int window_width, int window_height, const char* window_title,
 
     // Check 
     if (Variables::ShowMemStat) {
-        Variables::ShowMemStat = glfwExtensionSupported("GL_NVX_gpu_memory_info") == GLFW_TRUE;
+        Variables::ShowMemStat = glewIsSupported("GL_NVX_gpu_memory_info") == GL_TRUE;
         if (Variables::ShowMemStat) {
             glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &Statistic::GPUMemory::DedicatedMemory);
             glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &Statistic::GPUMemory::TotalMemory);
@@ -544,20 +694,24 @@ int common_main(int window_width, int window_height, const char* window_title,
         fprintf(stderr, "-------------------------------------------------------------------------------\n");
     }
 
-    glGenQueries(OpenGL::NumQueries, OpenGL::Query);
+    // GPU frame time, measured without waiting for the GPU (results are a few frames old)
+    Tools::GPUProfiler frame_profiler;
 
     // Set GLFW event callbacks
-    glfwSetWindowSizeCallback(Variables::Window, Callbacks::WindowSizeChanged);
-    glfwSetWindowCloseCallback(Variables::Window, Callbacks::WindowClosed);
-    glfwSetMouseButtonCallback(Variables::Window, Callbacks::MouseButtonChanged);
-    glfwSetCursorPosCallback(Variables::Window, Callbacks::MousePositionChanged);
-    glfwSetKeyCallback(Variables::Window, Callbacks::KeyboardChanged);
+    if (!bHeadless) {
+        glfwSetWindowSizeCallback(Variables::Window, Callbacks::WindowSizeChanged);
+        glfwSetWindowCloseCallback(Variables::Window, Callbacks::WindowClosed);
+        glfwSetMouseButtonCallback(Variables::Window, Callbacks::MouseButtonChanged);
+        glfwSetCursorPosCallback(Variables::Window, Callbacks::MousePositionChanged);
+        glfwSetKeyCallback(Variables::Window, Callbacks::KeyboardChanged);
+    }
 
     // Main loop
-    GLuint64 gpu_frame_start;
-    GLuint64 gpu_frame_end;
-    while (!glfwWindowShouldClose(Variables::Window) && !Variables::AppClose) {
-        glfwPollEvents();
+    int      gl_error_frames = 0;
+    while (bHeadless ? (Statistic::Frame::ID < Variables::HeadlessFrames) && !Variables::AppClose
+                     : !glfwWindowShouldClose(Variables::Window) && !Variables::AppClose) {
+        if (!bHeadless)
+            glfwPollEvents();
 
         // Increase frame counter
         Statistic::Frame::ID++;
@@ -602,10 +756,11 @@ int common_main(int window_width, int window_height, const char* window_title,
         // glFinish();
 
         const std::chrono::high_resolution_clock::time_point cpu_start = std::chrono::high_resolution_clock::now();
-        glQueryCounter(OpenGL::Query[OpenGL::FrameStartQuery], GL_TIMESTAMP);
+        frame_profiler.beginFrame();
+        frame_profiler.begin("Frame");
         if (Callbacks::User::Display)
             Callbacks::User::Display();
-        glQueryCounter(OpenGL::Query[OpenGL::FrameEndQuery], GL_TIMESTAMP);
+        frame_profiler.endFrame();
         const std::chrono::high_resolution_clock::time_point cpu_end = std::chrono::high_resolution_clock::now();
         Statistic::Frame::CPUTime = static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(cpu_end - cpu_start).count());
 
@@ -617,21 +772,30 @@ int common_main(int window_width, int window_height, const char* window_title,
         }
 
         glBindBuffer(GL_UNIFORM_BUFFER, 0);
-        glGetQueryObjectui64v(OpenGL::Query[OpenGL::FrameStartQuery], GL_QUERY_RESULT, &gpu_frame_start);
-        glGetQueryObjectui64v(OpenGL::Query[OpenGL::FrameEndQuery], GL_QUERY_RESULT, &gpu_frame_end);
-        Statistic::Frame::GPUTime = static_cast<int>(gpu_frame_end - gpu_frame_start);
 
-        // Count FPS
+        // Count FPS (every measured frame is counted once)
         static unsigned long GPUTimeSum    = 0;
         static unsigned int  FPSFrameCount = 0;
-        FPSFrameCount++;
-        GPUTimeSum += Statistic::Frame::GPUTime;
+        static int           LastGPUFrame  = -1;
+        if (frame_profiler.getResultsFrame() != LastGPUFrame) {
+            LastGPUFrame              = frame_profiler.getResultsFrame();
+            Statistic::Frame::GPUTime = static_cast<int>(frame_profiler.get("Frame"));
+            FPSFrameCount++;
+            GPUTimeSum += Statistic::Frame::GPUTime;
+        }
         if (GPUTimeSum > 1000000) {
             Statistic::FPS = FPSFrameCount * 1000000000.0f / static_cast<float>(GPUTimeSum);
             GPUTimeSum     = 0;
             FPSFrameCount  = 0;
         }
 
+        if (bHeadless) {
+            // No window to present to, just report frames that ended with an error
+            if (glGetError() != GL_NO_ERROR)
+                gl_error_frames++;
+            continue;
+        }
+
         // Show Magnifier
         ShowMagnifier();
 
@@ -645,7 +809,21 @@ int common_main(int window_width, int window_height, const char* window_title,
         glfwPollEvents();
     }
 
+    if (bHeadless) {
+        // Keep the last frame for inspection, framebuffer_<width>x<height>.raw (RGBA8)
+        Tools::SaveFrambuffer(Variables::Framebuffer, Variables::WindowSize.x, Variables::WindowSize.y);
+        fprintf(stderr, "Headless run finished, %d frames rendered, %d frames with OpenGL errors.\n", Statistic::Frame::ID, gl_error_frames);
+
+        frame_profiler.release();
+        if (Callbacks::User::OpenGLRelease)
+            Callbacks::User::OpenGLRelease();
+        Headless::DestroyContext();
+
+        return (gl_error_frames > 0) ? 5 : 0;
+    }
+
     // Cleanup
+    frame_profiler.release();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImPlot::DestroyContext();
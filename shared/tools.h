@@ -31,6 +31,8 @@ namespace Variables {
     bool           Debug             = false;
     bool           ShowMemStat       = true;
     bool           AppClose          = false;
+    int            HeadlessFrames    = 0;       // Number of frames rendered without a window (0 ... windowed mode)
+    GLuint         Framebuffer       = 0;       // Framebuffer presented as the "window" (offscreen FBO in headless mode)
     Transformation Transform;
 
 
@@ -76,10 +78,6 @@ namespace Statistic {
 }; // end of namespace Statistic
 
 namespace OpenGL {
-    enum eQueries {
-        FrameStartQuery = 0, FrameEndQuery, NumQueries
-    };
-
     struct Program {
         Program(GLuint _id) : id(_id) {
             MVPMatrix          = glGetUniformLocation(id, "u_MVPMatrix");
@@ -110,8 +108,6 @@ namespace OpenGL {
         GLint  FrameCounter;
     };
     std::vector<Program> programs;
-
-    GLuint Query[NumQueries] = {0};
 }; // end of namespace OpenGL
 
 
@@ -136,27 +132,58 @@ namespace Tools {
     }
 
 
-    // Very simple GPU timer (timer cannot be nested with other timer or GL_TIME_ELAPSED query
+    // Very simple GPU timer (timer cannot be nested with other timer or GL_TIME_ELAPSED query, use GPUProfiler instead)
+    // Queries are multi-buffered, get() returns the latest available result without waiting for the GPU
+    // Other single value query targets count instead of measuring time (e.g. GL_FRAGMENT_SHADER_INVOCATIONS_ARB)
     class GPUTimer {
     public:
-        GPUTimer() : query(0), time(0), time_total(0), counter(0) {}
+        static const int NUM_QUERIES = 4;  // Measurements in flight
+
+        explicit GPUTimer(GLenum target = GL_TIME_ELAPSED) : target(target), current(0), time(0), time_total(0), counter(0) {
+            for (int i = 0; i < NUM_QUERIES; i++) {
+                query[i]   = 0;
+                pending[i] = false;
+            }
+        }
         ~GPUTimer() {
-            glDeleteQueries(1, &query);
+            release();
+        }
+
+        // Deletes the queries, call before the OpenGL context is destroyed
+        void release() {
+            if (query[0] != 0)
+                glDeleteQueries(NUM_QUERIES, query);
+            for (int i = 0; i < NUM_QUERIES; i++) {
+                query[i]   = 0;
+                pending[i] = false;
+            }
         }
 
         void start() {
-            if (query == 0) glCreateQueries(GL_TIME_ELAPSED, 1, &query);
-            glBeginQuery(GL_TIME_ELAPSED, query);
+            if (query[0] == 0) glGenQueries(NUM_QUERIES, query);  // glCreateQueries() rejects pipeline statistics targets on some drivers
+            // The GPU is more than NUM_QUERIES measurements behind, the query has to be finished before reuse
+            if (pending[current]) read(current);
+            glBeginQuery(target, query[current]);
         }
 
-        void stop() const {
-            glEndQuery(GL_TIME_ELAPSED);
+        void stop() {
+            glEndQuery(target);
+            pending[current] = true;
+            current = (current + 1) % NUM_QUERIES;
         }
 
         unsigned int get() {
-            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &time);
-            time_total += time;
-            counter++;
+            // Collect finished measurements from the oldest one
+            for (int i = 0; i < NUM_QUERIES; i++) {
+                const int index = (current + i) % NUM_QUERIES;
+                if (!pending[index])
+                    continue;
+                GLint available = GL_FALSE;
+                glGetQueryObjectiv(query[index], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available == GL_FALSE)
+                    break;
+                read(index);
+            }
             return static_cast<unsigned int>(time);
         }
 
@@ -168,18 +195,273 @@ namespace Tools {
             return counter;
         }
 
+        // Query of the latest measurement, e.g. for the conditional rendering
+        GLuint getQuery() const {
+            return query[(current + NUM_QUERIES - 1) % NUM_QUERIES];
+        }
+
         void clear() {
             time_total = 0;
             counter    = 0;
         }
 
     private:
-        GLuint   query;
+        void read(int index) {
+            glGetQueryObjectui64v(query[index], GL_QUERY_RESULT, &time);
+            pending[index] = false;
+            time_total += time;
+            counter++;
+        }
+
+        GLenum   target;
+        GLuint   query[NUM_QUERIES];
+        bool     pending[NUM_QUERIES];
+        int      current;
         GLuint64 time;
         GLuint64 time_total;
         GLuint   counter;
     };
 
+    // GPU profiler with named scopes that can be nested (timestamp queries). Query sets of several frames are in
+    // flight and their results are read once available, so the reported times are a few frames old but measuring
+    // never stalls the pipeline.
+    class GPUProfiler {
+    public:
+        struct Scope {
+            std::string name;
+            int         depth;          // Nesting level, 0 ... top-level scope
+            GLuint64    time;           // Duration [ns]
+        };
+
+        explicit GPUProfiler(unsigned int frames_in_flight = 4) : frames(frames_in_flight > 0 ? frames_in_flight : 1), current(0),
+                                                                 frame_counter(0), result_frame(-1), recording(false) {}
+        ~GPUProfiler() {
+            release();
+        }
+
+        // Deletes the queries, call before the OpenGL context is destroyed
+        void release() {
+            for (size_t i = 0; i < frames.size(); i++) {
+                if (!frames[i].queries.empty())
+                    glDeleteQueries(static_cast<GLsizei>(frames[i].queries.size()), &frames[i].queries[0]);
+                frames[i].queries.clear();
+                frames[i].records.clear();
+                frames[i].used    = 0;
+                frames[i].pending = false;
+            }
+        }
+
+        void beginFrame() {
+            collect();
+
+            // The GPU is more than frames_in_flight frames behind, the query set has to be finished before reuse
+            Frame& frame = frames[current];
+            if (frame.pending) read(frame);
+
+            frame.records.clear();
+            frame.used = 0;
+            frame.id   = frame_counter++;
+            stack.clear();
+            recording = true;
+        }
+
+        void endFrame() {
+            while (!stack.empty())
+                end();
+            frames[current].pending = !frames[current].records.empty();
+            current   = (current + 1) % frames.size();
+            recording = false;
+        }
+
+        void begin(const char* name) {
+            if (!recording) return;
+            Frame& frame = frames[current];
+            Record record;
+            record.name  = name;
+            record.depth = static_cast<int>(stack.size());
+            record.begin = timestamp(frame);
+            record.end   = record.begin;
+            stack.push_back(frame.records.size());
+            frame.records.push_back(record);
+        }
+
+        void end() {
+            if (!recording || stack.empty()) return;
+            Frame& frame = frames[current];
+            frame.records[stack.back()].end = timestamp(frame);
+            stack.pop_back();
+        }
+
+        // Scopes of the latest frame with available results (in the order they were started)
+        const std::vector<Scope>& getResults() const {
+            return results;
+        }
+
+        // Index of the frame (counted by beginFrame()) the results belong to, -1 ... no results yet
+        int getResultsFrame() const {
+            return result_frame;
+        }
+
+        // Duration of the first scope with the given name in the results [ns], 0 if there is no such scope
+        GLuint64 get(const char* name) const {
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i].name == name)
+                    return results[i].time;
+            }
+            return 0;
+        }
+
+    private:
+        struct Record {
+            std::string name;
+            int         depth;
+            GLuint      begin;          // Query indices of the frame
+            GLuint      end;
+        };
+
+        struct Frame {
+            Frame() : used(0), id(0), pending(false) {}
+            std::vector<GLuint> queries;    // Timestamp queries, reused every time the frame slot is recorded
+            std::vector<Record> records;
+            GLuint              used;       // Queries issued in the frame
+            int                 id;
+            bool                pending;    // Results were not read yet
+        };
+
+        GLuint timestamp(Frame& frame) {
+            if (frame.used == frame.queries.size()) {
+                GLuint query = 0;
+                glGenQueries(1, &query);
+                frame.queries.push_back(query);
+            }
+            glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+            return frame.used++;
+        }
+
+        bool available(const Frame& frame) const {
+            for (GLuint i = 0; i < frame.used; i++) {
+                GLint result = GL_FALSE;
+                glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &result);
+                if (result == GL_FALSE)
+                    return false;
+            }
+            return true;
+        }
+
+        void read(Frame& frame) {
+            timestamps.resize(frame.used);
+            for (GLuint i = 0; i < frame.used; i++)
+                glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+            results.resize(frame.records.size());
+            for (size_t i = 0; i < frame.records.size(); i++) {
+                const Record& record = frame.records[i];
+                results[i].name  = record.name;
+                results[i].depth = record.depth;
+                results[i].time  = timestamps[record.end] - timestamps[record.begin];
+            }
+            result_frame  = frame.id;
+            frame.pending = false;
+        }
+
+        // Reads finished frames from the oldest one, never waits for the GPU
+        void collect() {
+            for (size_t i = 0; i < frames.size(); i++) {
+                Frame& frame = frames[(current + i) % frames.size()];
+                if (!frame.pending)
+                    continue;
+                if (!available(frame))
+                    break;
+                read(frame);
+            }
+        }
+
+        std::vector<Frame>    frames;
+        size_t                current;
+        int                   frame_counter;
+        std::vector<size_t>   stack;        // Open scopes (record indices)
+        std::vector<GLuint64> timestamps;
+        std::vector<Scope>    results;
+        int                   result_frame;
+        bool                  recording;
+    };
+
+    // Asynchronous buffer readback, copies of the buffer are in flight and read() returns the newest copy the GPU
+    // has finished without waiting (the data are a few frames old)
+    class BufferReadback {
+    public:
+        static const int NUM_COPIES = 3;  // Copies in flight
+
+        BufferReadback() : size(0), current(0) {
+            for (int i = 0; i < NUM_COPIES; i++) {
+                buffers[i] = 0;
+                fences[i]  = 0;
+            }
+        }
+        ~BufferReadback() {
+            release();
+        }
+
+        // Copies the range of the buffer, it can be read once the GPU has executed the copy
+        void copy(GLuint buffer, GLintptr offset, GLsizeiptr copy_size) {
+            if (size != copy_size) {
+                release();
+                glCreateBuffers(NUM_COPIES, buffers);
+                for (int i = 0; i < NUM_COPIES; i++)
+                    glNamedBufferStorage(buffers[i], copy_size, NULL, GL_CLIENT_STORAGE_BIT);
+                size = copy_size;
+            }
+            if (fences[current] != 0)
+                glDeleteSync(fences[current]);
+            glCopyNamedBufferSubData(buffer, buffers[current], offset, 0, size);
+            fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            current = (current + 1) % NUM_COPIES;
+        }
+
+        // Reads the newest finished copy, false if no copy newer than the last read one has finished
+        bool read(void* data) {
+            for (int i = 1; i <= NUM_COPIES; i++) {
+                const int index = (current + NUM_COPIES - i) % NUM_COPIES;
+                if (fences[index] == 0)
+                    continue;
+                const GLenum status = glClientWaitSync(fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                if ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED))
+                    continue;
+                glGetNamedBufferSubData(buffers[index], 0, size, data);
+
+                // This copy and the older ones are consumed
+                for (int j = i; j <= NUM_COPIES; j++) {
+                    const int older = (current + NUM_COPIES - j) % NUM_COPIES;
+                    if (fences[older] != 0)
+                        glDeleteSync(fences[older]);
+                    fences[older] = 0;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        // Deletes the buffers and fences, call before the OpenGL context is destroyed
+        void release() {
+            for (int i = 0; i < NUM_COPIES; i++) {
+                if (fences[i] != 0)
+                    glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+            if (buffers[0] != 0)
+                glDeleteBuffers(NUM_COPIES, buffers);
+            for (int i = 0; i < NUM_COPIES; i++)
+                buffers[i] = 0;
+            size = 0;
+        }
+
+    private:
+        GLuint     buffers[NUM_COPIES];
+        GLsync     fences[NUM_COPIES];
+        GLsizeiptr size;
+        int        current;
+    };
+
     // Very simple CPU timer
     class CPUTimer {
     public:
@@ -619,6 +901,7 @@ namespace Tools {
                 case GL_GEOMETRY_SHADER       : fprintf(stderr, "geometry shader creation ... "); break;
                 case GL_TESS_CONTROL_SHADER   : fprintf(stderr, "tesselation control shader creation ... "); break;
                 case GL_TESS_EVALUATION_SHADER: fprintf(stderr, "tesselation evaluation shader creation ... "); break;
+                case GL_COMPUTE_SHADER        : fprintf(stderr, "compute shader creation ... "); break;
                 default                       : return 0;
             }
 
@@ -653,13 +936,25 @@ namespace Tools {
 
             std::string shader_header;
             if (preprocessor) {
+                // Stage of the shader, the preprocessor code can be shared by the shaders of a program
+                switch (shader_type) {
+                    case GL_VERTEX_SHADER         : shader_header += "#define VERTEX_SHADER\n"; break;
+                    case GL_FRAGMENT_SHADER       : shader_header += "#define FRAGMENT_SHADER\n"; break;
+                    case GL_GEOMETRY_SHADER       : shader_header += "#define GEOMETRY_SHADER\n"; break;
+                    case GL_TESS_CONTROL_SHADER   : shader_header += "#define TESS_CONTROL_SHADER\n"; break;
+                    case GL_TESS_EVALUATION_SHADER: shader_header += "#define TESS_EVALUATION_SHADER\n"; break;
+                    case GL_COMPUTE_SHADER        : shader_header += "#define COMPUTE_SHADER\n"; break;
+                    default                       : break;
+                }
                 shader_header += preprocessor;
             }
             if (Variables::Shader::UserTest) {
                 shader_header += "#define USER_TEST\n";
             }
             
-            std::string shader_source = fileContent;
+            // Skip UTF-8 byte order mark, it is not accepted by all GLSL compilers (Mesa)
+            const bool has_bom = (strncmp(fileContent, "\xEF\xBB\xBF", 3) == 0);
+            std::string shader_source = fileContent + (has_bom ? 3 : 0);
             if (!shader_header.empty()) {
                 std::size_t insertIdx = shader_source.find("\n", shader_source.find("#version"));
                 shader_source.insert((insertIdx != std::string::npos) ? insertIdx : 0, std::string("\n") + shader_header + "\n\n");
@@ -791,6 +1086,39 @@ namespace Tools {
 
             return true;
         }
+
+
+        //-----------------------------------------------------------------------------
+        // Name: CreateComputeProgramFromFile()
+        // Desc: 
+        //-----------------------------------------------------------------------------
+        bool CreateComputeProgramFromFile(GLuint& programId, const char* cs, const char* preprocessor = nullptr) {
+            GLuint shader_id = CreateShaderFromFile(GL_COMPUTE_SHADER, cs, preprocessor);
+            if (shader_id == 0)
+                return false;
+
+            // Create shader program object
+            GLuint pr_id = glCreateProgram();
+            glAttachShader(pr_id, shader_id);
+            glDeleteShader(shader_id);
+            glLinkProgram(pr_id);
+            if (!CheckProgramLinkStatus(pr_id)) {
+                CheckProgramInfoLog(pr_id);
+                fprintf(stderr, "Program linking failed!\n");
+                fprintf(stderr, "-------------------------------------------------------------------------------\n");
+                glDeleteProgram(pr_id);
+                return false;
+            }
+
+            // Remove program from OpenGL and update internal list
+            glDeleteProgram(programId);
+            _updateProgramList(programId, pr_id);
+            programId = pr_id;
+
+            fprintf(stderr, "-------------------------------------------------------------------------------\n");
+
+            return true;
+        }
     } // end of namespace Shader
 
 
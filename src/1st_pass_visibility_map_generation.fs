@@ -1,8 +1,37 @@
 #version 430 core
 
+#ifdef FUSED_LIST_GENERATION
+// The depth prepass leaves only the visible fragments (depth test GL_EQUAL), they are inserted into the lists
+// directly instead of in the full-screen list buffer generation pass (2nd_pass_list_buffer_generation.fs)
+layout (early_fragment_tests) in;
+
+// Size of the visibility map, the list capacity is one node per pixel
+layout (location = 4) uniform ivec2 u_VisibilityMapSize;
+#endif
+
+#ifdef VISIBILITY_BUFFER
+// Visibility buffer instead of the light space position: index of the captured triangle + 1 (0 ... empty pixel) and the
+// barycentrics of its 2nd and 3rd vertex, resolved by fetchCameraSample() of the following passes
+layout (location = 0) out uvec2 FragColor0;
+
+in vec2 v_Barycentric;
+#else
+// Light view space position (RGBA32F or RGBA16F) or only the camera view space depth (R32F), see fetchCameraSample()
+// and the VISIBILITY_* encodings in alias_free_common.glsl
 layout (location = 0) out vec4 FragColor0;
+
+layout (location = 11) uniform int u_VisibilityEncoding;
+#endif
 layout (location = 1) out vec4 FragColor1;
 
+// fp32 light view space positions, attached only for the error report of the compact encodings
+layout (location = 2) out vec4 FragColor2;
+
+// Several lights are shaded by pass 4, the lighting map then stores the albedo and the normals are attached
+layout (location = 3) out vec4 FragColor3;
+layout (location = 8) uniform bool u_MultipleLights;
+
+// View space light position, the direction to the light with w = 0 (directional light)
 layout (location = 3) uniform vec4  u_LightPosition;
 
 layout (binding = 0) uniform sampler2D u_SceneTexture;
@@ -16,11 +45,23 @@ void main(void) {
 
     // Compute fragment diffuse color
     vec3 N      = normalize(v_Normal);
-    vec3 L      = normalize(u_LightPosition.xyz - v_Vertex.xyz);
+    vec3 L      = normalize(u_LightPosition.xyz - v_Vertex.xyz * u_LightPosition.w);
     float NdotL = max(dot(N, L), 0.0);
-    vec4 color  = texture(u_SceneTexture, v_TexCoord) * NdotL;
+    vec4 albedo = texture(u_SceneTexture, v_TexCoord);
+    vec4 color  = u_MultipleLights ? albedo : albedo * NdotL;
 
-    FragColor0 = vec4(v_LightSpacePos.xyz, 1.0);
+#ifdef VISIBILITY_BUFFER
+    FragColor0 = uvec2(uint(gl_PrimitiveID) + 1U, packUnorm2x16(v_Barycentric));
+#else
+    FragColor0 = (u_VisibilityEncoding == VISIBILITY_DEPTH) ? vec4(-v_Vertex.z) : vec4(v_LightSpacePos.xyz, 1.0);
+#endif
     FragColor1 = color;
+    FragColor2 = vec4(v_LightSpacePos.xyz, 1.0);
+    FragColor3 = vec4(N, 0.0);
 
+#ifdef FUSED_LIST_GENERATION
+    // Same insertion as 2nd_pass_list_buffer_generation.fs, the sample position comes from the interpolated attribute
+    // (the color outputs are written for the samples outside of the light frustum too)
+    insertSample(ivec2(gl_FragCoord.xy), v_LightSpacePos.xyz, u_VisibilityMapSize);
+#endif
 }
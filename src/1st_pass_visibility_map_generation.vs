@@ -4,16 +4,44 @@ layout(location = 0) uniform mat4  u_ModelViewMatrix;
 layout(location = 1) uniform mat4  u_ProjectionMatrix;
 layout(location = 2) uniform mat4  u_LightViewMatrix;
 
+#ifdef VISIBILITY_BUFFER
+// The scene is pulled from the transform feedback capture (3 vertices per triangle, drawn without vertex attributes),
+// so gl_PrimitiveID is the index of the captured triangle and of its light space record
+layout (std430, binding = 9) readonly buffer SceneVertices {
+    float scene_vertices[];
+};
+
+// Normal and texture coordinates of the captured vertices (5 floats per vertex)
+layout (std430, binding = 10) readonly buffer SceneAttributes {
+    float scene_attributes[];
+};
+
+// Barycentric coordinates of the 2nd and 3rd vertex
+out vec2 v_Barycentric;
+#else
 in vec4 a_Vertex;
 in vec3 a_Normal;
 in vec2 a_TexCoord;
+#endif
 
 out vec3 v_Normal;
 out vec2 v_TexCoord;
 out vec4 v_Vertex;
 out vec4 v_LightSpacePos;
 
+// The depth prepass runs this shader too, the visibility pass then shades with the depth test GL_EQUAL
+invariant gl_Position;
+
 void main(void) {
+#ifdef VISIBILITY_BUFFER
+    int  vertex     = 3 * gl_VertexID;
+    int  attributes = 5 * gl_VertexID;
+    vec4 a_Vertex   = vec4(scene_vertices[vertex], scene_vertices[vertex + 1], scene_vertices[vertex + 2], 1.0);
+    vec3 a_Normal   = vec3(scene_attributes[attributes], scene_attributes[attributes + 1], scene_attributes[attributes + 2]);
+    vec2 a_TexCoord = vec2(scene_attributes[attributes + 3], scene_attributes[attributes + 4]);
+    v_Barycentric   = vec2(equal(ivec2(gl_VertexID % 3), ivec2(1, 2)));
+#endif
+
     v_LightSpacePos = u_LightViewMatrix * a_Vertex;
 
     v_Vertex   = u_ModelViewMatrix * a_Vertex;
@@ -0,0 +1,64 @@
+#version 430 core
+
+// Compacted (CSR) variant of the list buffer generation, it runs twice:
+//   COUNT_SAMPLES defined ... number of samples of every light texel
+//   otherwise             ... samples are scattered to the ranges [texel_offsets[texel], texel_offsets[texel + 1])
+//                             computed by the exclusive prefix sum of the counts
+
+// Sample counts, after the prefix sum the first sample of every light texel of the layers (layers * resolution^2 + 1 items)
+layout (std430, binding = 0) buffer TexelOffsets {
+    uint texel_offsets[];
+};
+
+// Insertion positions, copy of the texel offsets
+layout (std430, binding = 1) buffer TexelCursors {
+    uint texel_cursors[];
+};
+
+// Visibility map coordinates of the samples (x | y << 16)
+layout (std430, binding = 2) writeonly buffer Samples {
+    uint samples[];
+};
+
+// Light texel grid resolution
+layout (location = 0) uniform int u_Resolution;
+
+void main(void) {
+
+	// Read sample position from the visibility map that is transformed to the light space
+	vec4 camera_sample_pos = fetchCameraSample(ivec2(gl_FragCoord.xy));
+
+	if(camera_sample_pos.w != 1.0f) {
+		discard;
+    }
+
+	// Light texels of the sample in the layers, same texels as in the linked list generation
+	bool  inserted = false;
+	ivec2 layers   = sampleLayers(camera_sample_pos.xyz);
+	for (int layer = layers.x; layer < layers.y; layer++) {
+		ivec2 texel_coord;
+		vec3  light_pos;
+		if (!lightTexel(layer, camera_sample_pos.xyz, u_Resolution, texel_coord, light_pos)) {
+			continue;
+		}
+		uint texel = uint((layer * u_Resolution + texel_coord.y) * u_Resolution + texel_coord.x);
+		inserted = true;
+
+#ifdef COUNT_SAMPLES
+		atomicAdd(texel_offsets[texel], 1U);
+
+		updateReceiverDepthTile(texel_coord, layer, light_pos);
+		countViewSample(layer);
+#else
+		// Allocate a slot in the range of the texel
+		uint index = atomicAdd(texel_cursors[texel], 1U);
+		uvec2 coord = uvec2(gl_FragCoord.xy);
+		samples[index] = coord.x | (coord.y << 16);
+#endif
+	}
+
+	// Samples outside of the light frusta are not counted by the list sample query
+	if (!inserted) {
+		discard;
+	}
+}
@@ -0,0 +1,32 @@
+#version 430 core
+
+// Marks light texels with a non-empty list in the stencil buffer of the shadow test framebuffer (stencil op
+// GL_REPLACE with the generation as reference value), fragments of empty texels are discarded. The shadow test
+// then runs with the early stencil test and the fragments over empty texels never launch the shader. The geometry
+// shader draws the full screen rectangle to every layer of the batch of light views.
+
+#ifdef COMPACTED_LIST
+// First sample of every light texel of the layers (layers * resolution^2 + 1 items)
+layout (std430, binding = 0) readonly buffer TexelOffsets {
+    uint texel_offsets[];
+};
+
+// Light texel grid resolution
+layout (location = 2) uniform int u_Resolution;
+#else
+// Head pointers of the layers
+layout (binding = 2) uniform usampler2DArray head_pointer_image;
+
+// Generation of the current frame, older head pointers mark empty lists
+layout (location = 5) uniform uint u_Generation;
+#endif
+
+void main(void) {
+
+#ifdef COMPACTED_LIST
+    uint texel = (uint(gl_Layer) * uint(u_Resolution) + uint(gl_FragCoord.y)) * uint(u_Resolution) + uint(gl_FragCoord.x);
+    if (texel_offsets[texel + 1] == texel_offsets[texel]) discard;
+#else
+    if ((texelFetch(head_pointer_image, ivec3(gl_FragCoord.xy, gl_Layer), 0).x >> NODE_INDEX_BITS) != u_Generation) discard;
+#endif
+}
@@ -0,0 +1,21 @@
+#version 430 core
+
+// Draws the full screen rectangle of the light texel occupancy to every layer of the batch of light views
+
+layout(triangles, invocations = MAX_VIEW_LAYERS) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+// Layers of the batch
+layout (location = 24) uniform int u_NumLayers;
+
+void main() {
+
+    if (gl_InvocationID >= u_NumLayers) return;
+
+    for(int i = 0; i < gl_in.length(); i++) {
+        gl_Position = gl_in[i].gl_Position;
+        gl_Layer    = gl_InvocationID;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
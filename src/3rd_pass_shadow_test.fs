@@ -6,90 +6,232 @@
 uniform int   u_UserVariableInt;
 uniform float u_UserVariableFloat;
 
-// Camera visibility
-layout (binding = 1) uniform sampler2D visibility_map;
-
-// Head pointer 2D buffer
-layout (binding = 2) uniform usampler2D head_pointer_image;
-
+// Fragments over empty light texels are rejected by the stencil test before the shader runs
+layout (early_fragment_tests) in;
+
+#ifdef COMPACTED_LIST
+// First sample of every light texel of the layers (layers * resolution^2 + 1 items)
+layout (std430, binding = 0) readonly buffer TexelOffsets {
+    uint texel_offsets[];
+};
+
+// Visibility map coordinates of the samples (x | y << 16)
+layout (std430, binding = 2) readonly buffer Samples {
+    uint samples[];
+};
+
+#ifdef LOAD_BALANCING
+// Fragments with longer lists are tested by the work groups of 3rd_pass_shadow_test_heavy_lists.cs
+const uint HEAVY_LIST_LENGTH = 64U;
+
+// Triangle of the fragment, the w components of the vertices hold the sample range and the layer (uint bits)
+struct HeavyList {
+    vec4 triangle_vertices[3];
+    vec4 plane;
+};
+
+layout (std430, binding = 6) buffer HeavyLists {
+    uint      num_heavy_lists;
+    HeavyList heavy_lists[];
+};
+#endif
+#else
+// Head pointers of the layers
+layout (binding = 2) uniform usampler2DArray head_pointer_image;
+
+// The compact nodes are written as std430 buffer (ListNodes in 2nd_pass_list_buffer_generation.fs) and read
+// through a buffer image of the same storage
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+// Linked list nodes, only the pointer to the next node is stored (the node index is the pixel index)
+layout (binding = 2, r32ui) uniform readonly uimageBuffer list_buffer;
+#elif defined(COMPACT_NODES)
+// Linked list nodes (pointer to the next node, visibility map coordinates x | y << 16)
+layout (binding = 2, rg32ui) uniform readonly uimageBuffer list_buffer;
+#else
 // Linked list 1D buffer
 layout (binding = 2, rgba32ui) uniform uimageBuffer list_buffer;
+#endif
+#endif
 
-// Shadow map 2D texture
-layout (binding = 3, r32ui) uniform uimage2D shadow_map;
+// Light texel grid resolution
+layout (location = 2) uniform int u_Resolution;
 
+// Maximum light distance of the receivers in 8x8 and 32x32 light texel tiles (generation << 24 | upper 24 bits of the float)
+layout (binding = 5, r32ui) uniform readonly uimage2DArray receiver_depth_tiles;
+layout (binding = 6, r32ui) uniform readonly uimage2DArray receiver_depth_tiles_coarse;
+layout (location = 6) uniform bool u_ReceiverDepthTiles;
+
+#ifdef VERTEX_PULLING
+// The fragment reads the record of its primitive from the triangles of the triangle setup (alias_free_common.glsl)
+in Data {
+    smooth vec4 v_LightSpacePos;
+#ifdef CONSERVATIVE_RASTER
+    flat vec4 bounds;
+#endif
+} In;
+#else
 in Data {
     smooth vec4 v_LightSpacePos;
     flat vec4 plane; // plane.xyz := n (plane normal), plane.w := d (dot(n,p) for a given point p on the plane)
     flat vec3 triangle_vertices[3];
+#ifdef CONSERVATIVE_RASTER
+    flat vec4 bounds;
+#endif
 } In;
+#endif
 
-const float SHADOW_ACNE_EPSILON = 0.0001;
+// Lower bound of the light distance of the triangle inside the light texel
+float occluderMinDepth(ivec2 texel);
 
+// Decodes the maximum light distance of the receivers in the tile, -1 for tiles without samples in this frame
+float receiverMaxDepth(uint tile);
 
-// Test if point p lies inside the ccw triangle
-bool pointInsideTriangle(vec3 p);
+void main(void) {
 
-// Test if shadow ray starting from the point a in the direction v intersects triangle
-bool intersectRayTriangle(vec3 a, vec3 v);
+    // View of the layer of the batch
+#ifdef LAYERED
+    int layer = gl_Layer;
+#else
+    int layer = 0;
+#endif
+    light_view = views[u_FirstView + layer];
 
-void main(void) {
+#ifdef CONSERVATIVE_RASTER
+    // Texels of the enlarged triangle outside of the bounding box of the triangle (bounds in light texels)
+    vec2 texel_min = floor(gl_FragCoord.xy);
+    if (any(lessThan(texel_min + 1.0, In.bounds.xy)) || any(greaterThan(texel_min, In.bounds.zw))) discard;
+#endif
 
-    uint curr_index = texelFetch(head_pointer_image, ivec2(gl_FragCoord.xy), 0).x;
+#ifdef VERTEX_PULLING
+    plane = triangles[gl_PrimitiveID].plane;
+    for (int i = 0; i < 3; i++) {
+        triangle_vertices[i] = triangles[gl_PrimitiveID].triangle_vertices[i].xyz;
+        edges[i]             = triangles[gl_PrimitiveID].edges[i];
+    }
+    // The records are in the stored light view space (the main light)
+    if (light_view.sample_to_light != mat4(1.0)) {
+        mat3 rotation    = mat3(light_view.sample_to_light);
+        vec3 translation = light_view.sample_to_light[3].xyz;
+        for (int i = 0; i < 3; i++)
+            triangle_vertices[i] = rotation * triangle_vertices[i] + translation;
+        plane.xyz = rotation * plane.xyz;
+        plane.w  += dot(plane.xyz, translation);
+        if (u_EdgeFunctions)
+            setupEdgeFunctions();
+    }
+#else
+    plane             = In.plane;
+    triangle_vertices = In.triangle_vertices;
+    // The triangles from the geometry shader have no edge functions, the pulled records have them
+    if (u_EdgeFunctions)
+        setupEdgeFunctions();
+#endif
 
-    // Linked list traversal
-    while(curr_index != 0xFFFFFFFF) {
+    if (u_ReceiverDepthTiles) {
+        // The triangle can only shadow receivers farther from the light, test the coarse tile first
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        float occluder_depth = occluderMinDepth(texel);
+        if (occluder_depth > receiverMaxDepth(imageLoad(receiver_depth_tiles_coarse, ivec3(texel >> 5, layer)).x)) discard;
+        if (occluder_depth > receiverMaxDepth(imageLoad(receiver_depth_tiles, ivec3(texel >> 3, layer)).x)) discard;
+    }
+
+#ifdef COMPACTED_LIST
+    uint texel = (uint(layer) * uint(u_Resolution) + uint(gl_FragCoord.y)) * uint(u_Resolution) + uint(gl_FragCoord.x);
+    uint begin = texel_offsets[texel];
+    uint end   = texel_offsets[texel + 1];
+
+#ifdef LOAD_BALANCING
+    // The long list is split among the invocations of a work group, this invocation only hands over the triangle
+    // (the list is tested here if the buffer is full)
+    if (end - begin > HEAVY_LIST_LENGTH) {
+        uint slot = atomicAdd(num_heavy_lists, 1U);
+        if (slot < uint(heavy_lists.length())) {
+            heavy_lists[slot].triangle_vertices[0] = vec4(triangle_vertices[0], uintBitsToFloat(begin));
+            heavy_lists[slot].triangle_vertices[1] = vec4(triangle_vertices[1], uintBitsToFloat(end));
+            heavy_lists[slot].triangle_vertices[2] = vec4(triangle_vertices[2], uintBitsToFloat(uint(layer)));
+            heavy_lists[slot].plane                = plane;
+            return;
+        }
+    }
+#endif
+
+    // Samples of the light texel are stored contiguously
+    for (uint index = begin; index < end; index++) {
 
+        // Coordinates of point in the visibility map
+        ivec2 visibility_map_coord = ivec2(samples[index] & 0xFFFFU, samples[index] >> 16);
+#else
+    uint curr_index = texelFetch(head_pointer_image, ivec3(gl_FragCoord.xy, layer), 0).x;
+
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+    uvec2 size = uvec2(cameraSampleSize());
+#endif
+
+    // Linked list traversal, pointers written in older frames mark the end of the list
+    while((curr_index >> NODE_INDEX_BITS) == u_Generation) {
+
+        uint node_index = curr_index & NODE_INDEX_MASK;
+
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+        // The node index is the pixel index of the point in the visibility map (in the nodes of its sample copy)
+        ivec2 visibility_map_coord = ivec2(node_index % size.x, (node_index / size.x) % size.y);
+        curr_index = imageLoad(list_buffer, int(node_index)).x;
+#elif defined(COMPACT_NODES)
+        // node.x contains pointer to the next node, node.y coordinates of point in the visibility map
+        uvec2 node = imageLoad(list_buffer, int(node_index)).xy;
+        curr_index = node.x;
+        ivec2 visibility_map_coord = ivec2(node.y & 0xFFFFU, node.y >> 16);
+#else
         // Read an entry from the linked list
-        uvec4 entry = imageLoad(list_buffer, int(curr_index));
+        uvec4 entry = imageLoad(list_buffer, int(node_index));
 
         // entry.x contains pointer to the next entry in the linked list
         curr_index = entry.x;
 
         // entry.yz contains coordinates of point in the visibility map
         ivec2 visibility_map_coord = ivec2(entry.yz);
+#endif
+#endif
 
-        // Transform point in world coordinates to the light space
-        vec4 p = texelFetch(visibility_map, visibility_map_coord, 0);
-
-        // Test if the fragment lies in shadow
-        if(intersectRayTriangle(p.xyz + normalize(-p.xyz) * SHADOW_ACNE_EPSILON, -p.xyz)) {
-            imageStore(shadow_map, ivec2(visibility_map_coord), uvec4(1));
-        } 
+        shadowTestSample(visibility_map_coord);
     }
 }
 
-bool pointInsideTriangle(vec3 p) {
-
-    // Translate point and triangle so that point lies at origin
-    vec3 a = In.triangle_vertices[0] - p; 
-    vec3 b = In.triangle_vertices[1] - p; 
-    vec3 c = In.triangle_vertices[2] - p;
-    float ab = dot(a, b);
-    float ac = dot(a, c);
-    float bc = dot(b, c);
-    float cc = dot(c, c);
-
-    // Make sure plane normals for triangles pab and pbc point in the same direction
-    if (bc * ac - cc * ab < 0.0) return false;
+float occluderMinDepth(ivec2 texel) {
+
+    // Nearest vertex
+    float depth = -max(max(triangle_vertices[0].z, triangle_vertices[1].z), triangle_vertices[2].z);
+
+    if (u_Directional) {
+        // Parallel rays through the texel corners, the depth is linear across the texel
+        vec2 scale   = vec2(light_view.projection[0][0], light_view.projection[1][1]);
+        vec2 offset  = vec2(light_view.projection[3][0], light_view.projection[3][1]);
+        vec2 corner0 = (vec2(texel) / float(u_Resolution) * 2.0 - 1.0 - offset) / scale;
+        vec2 corner1 = (vec2(texel + 1) / float(u_Resolution) * 2.0 - 1.0 - offset) / scale;
+        if (plane.z != 0.0) {
+            vec4 plane_depth = (vec4(dot(plane.xy, corner0), dot(plane.xy, vec2(corner1.x, corner0.y)),
+                                     dot(plane.xy, vec2(corner0.x, corner1.y)), dot(plane.xy, corner1)) - plane.w) / plane.z;
+            depth = max(depth, min(min(plane_depth.x, plane_depth.y), min(plane_depth.z, plane_depth.w)));
+        }
+        return depth;
+    }
 
-    // Make sure plane normals for triangles pab and pca point in the same direction
-    float bb = dot(b, b);
-    if (ab * bc - ac * bb < 0.0) return false;
+    // Plane along the rays through the texel corners (points of the rays at z = -1), 1/depth is linear across
+    // the texel, so the corners bound the depth unless the plane is parallel to a ray inside the texel
+    vec2 scale  = vec2(light_view.projection[0][0], light_view.projection[1][1]);
+    vec2 offset = vec2(light_view.projection[2][0], light_view.projection[2][1]);
+    vec2 ray0 = (vec2(texel) / float(u_Resolution) * 2.0 - 1.0 + offset) / scale;
+    vec2 ray1 = (vec2(texel + 1) / float(u_Resolution) * 2.0 - 1.0 + offset) / scale;
+    vec4 nd = vec4(dot(plane.xyz, vec3(ray0.x, ray0.y, -1.0)), dot(plane.xyz, vec3(ray1.x, ray0.y, -1.0)),
+                   dot(plane.xyz, vec3(ray0.x, ray1.y, -1.0)), dot(plane.xyz, vec3(ray1.x, ray1.y, -1.0)));
+    if (all(greaterThan(nd, vec4(0.0))) || all(lessThan(nd, vec4(0.0)))) {
+        vec4 plane_depth = plane.w / nd;
+        depth = max(depth, min(min(plane_depth.x, plane_depth.y), min(plane_depth.z, plane_depth.w)));
+    }
 
-    // Otherwise p must be in or on the triangle
-    return true;
+    return depth;
 }
 
-bool intersectRayTriangle(vec3 a, vec3 v) {
-    
-    // Intersect plane
-    float t = (In.plane.w - dot(In.plane.xyz, a)) / dot(In.plane.xyz, v);
-
-    if(0.0 <= t) {
-        // Plane was intersected, check if the intersection lies inside the triangle
-        return pointInsideTriangle(a + t * v);
-    }
-
-    return false;
+float receiverMaxDepth(uint tile) {
+    return ((tile >> 24) == u_Generation) ? uintBitsToFloat((tile & 0xFFFFFFU) << 8) : -1.0;
 }
@@ -1,4 +1,4 @@
-#version 400 core
+#version 430 core
 
 #ifdef USER_TEST
 #endif
@@ -22,11 +22,17 @@ out gl_PerVertex {
     float gl_CullDistance[];
 };*/
 
+#ifdef LAYERED
+// Every invocation emits the triangle to one layer of the batch of light views, the input is in the stored light
+// view space (the main light)
+layout(triangles, invocations = MAX_VIEW_LAYERS) in;
+#else
 layout(triangles) in;
+#endif
 layout(triangle_strip, max_vertices = 3) out;
 
 in Data {
-    vec4 v_LightSpacePos;
+    smooth vec4 v_LightSpacePos;
     flat vec4 plane;
     flat vec3 triangle_vertices[3];
 } In[];
@@ -35,22 +41,53 @@ out Data {
     smooth vec4 v_LightSpacePos;
     flat vec4 plane; // plane.xyz := n (plane normal), plane.w := d (dot(n,p) for a given point p on the plane)
     flat vec3 triangle_vertices[3];
+#ifdef CONSERVATIVE_RASTER
+    flat vec4 bounds;
+#endif
 } Out;
 
 // Computes plane equation from three colinear points (ordered ccw)
 vec4 computePlane(vec3 a, vec3 b, vec3 c);
 
 void main() {
-    
-    vec4 triangle_plane = computePlane(In[0].v_LightSpacePos.xyz, In[1].v_LightSpacePos.xyz, In[2].v_LightSpacePos.xyz);
+
+    vec4 light_space_pos[3];
+    vec4 position[3];
+#ifdef LAYERED
+    // The triangle only goes to the views with samples whose light frustum it overlaps
+    int layer = gl_InvocationID;
+    if ((layer >= u_NumLayers) || (view_samples[u_FirstView + layer] == 0U)) return;
+    mat4 sample_to_light = views[u_FirstView + layer].sample_to_light;
+    mat4 projection      = views[u_FirstView + layer].projection;
+    for(int i = 0; i < gl_in.length(); i++) {
+        light_space_pos[i] = sample_to_light * In[i].v_LightSpacePos;
+        position[i]        = projection * light_space_pos[i];
+    }
+    if (outsideLightFrustum(position[0], position[1], position[2])) return;
+#else
+    for(int i = 0; i < gl_in.length(); i++) {
+        light_space_pos[i] = In[i].v_LightSpacePos;
+        position[i]        = gl_in[i].gl_Position;
+    }
+#endif
+
+    vec4 triangle_plane = computePlane(light_space_pos[0].xyz, light_space_pos[1].xyz, light_space_pos[2].xyz);
 
     for(int i = 0; i < gl_in.length(); i++) {
         for(int j = 0; j < gl_in.length(); j++) {
-            Out.triangle_vertices[j] = In[j].v_LightSpacePos.xyz;
+            Out.triangle_vertices[j] = light_space_pos[j].xyz;
         }
         Out.plane = triangle_plane;
-        Out.v_LightSpacePos = In[i].v_LightSpacePos;
-        gl_Position = gl_in[i].gl_Position;
+        Out.v_LightSpacePos = light_space_pos[i];
+        gl_Position = position[i];
+#ifdef LAYERED
+        gl_Layer = layer;
+#endif
+#ifdef CONSERVATIVE_RASTER
+        // Enlarged triangle (conservativeVertex() in alias_free_common.glsl)
+        gl_Position = conservativeVertex(position[(i + 2) % 3], position[i], position[(i + 1) % 3]);
+        Out.bounds  = conservativeBounds(position[0], position[1], position[2]);
+#endif
         EmitVertex();
     }
     EndPrimitive();
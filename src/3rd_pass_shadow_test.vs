@@ -3,6 +3,49 @@
 layout(location = 0) uniform mat4  u_ModelViewMatrix;
 layout (location = 1) uniform mat4  u_ProjectionMatrix;
 
+#ifdef VERTEX_PULLING
+// Light space triangles of 3rd_pass_triangle_setup.cs (struct Triangle and Triangles in alias_free_common.glsl)
+out Data {
+    smooth vec4 v_LightSpacePos;
+#ifdef CONSERVATIVE_RASTER
+    flat vec4 bounds;
+#endif
+} Out;
+
+void main(void) {
+    // The records are in the stored light view space (the main light), the layered shadow test draws an instance per
+    // layer of the batch of light views (ARB_shader_viewport_layer_array)
+#ifdef LAYERED
+    int  layer = gl_InstanceID;
+    gl_Layer   = layer;
+#else
+    int  layer = 0;
+#endif
+    mat4 sample_to_light = views[u_FirstView + layer].sample_to_light;
+    mat4 projection      = views[u_FirstView + layer].projection;
+    Out.v_LightSpacePos = sample_to_light * vec4(triangles[gl_VertexID / 3].triangle_vertices[gl_VertexID % 3].xyz, 1.0);
+    gl_Position     = projection * Out.v_LightSpacePos;
+
+#if defined(CONSERVATIVE_RASTER) || defined(LAYERED)
+    // The record has all three vertices
+    int  i = gl_VertexID % 3;
+    vec4 v[3];
+    for (int k = 0; k < 3; k++)
+        v[k] = projection * (sample_to_light * vec4(triangles[gl_VertexID / 3].triangle_vertices[k].xyz, 1.0));
+#endif
+#ifdef CONSERVATIVE_RASTER
+    // Enlarged triangle (conservativeVertex() in alias_free_common.glsl)
+    gl_Position = conservativeVertex(v[(i + 2) % 3], v[i], v[(i + 1) % 3]);
+    Out.bounds  = conservativeBounds(v[0], v[1], v[2]);
+#endif
+#ifdef LAYERED
+    // The triangle only goes to the views with samples whose light frustum it overlaps, all of its vertices are
+    // moved out of the clip volume otherwise
+    if ((view_samples[u_FirstView + layer] == 0U) || outsideLightFrustum(v[0], v[1], v[2]))
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+#endif
+}
+#else
 layout (location = 0) in vec4 a_Vertex;
 
 out Data {
@@ -15,3 +58,4 @@ void main(void) {
     Out.v_LightSpacePos = u_ModelViewMatrix * a_Vertex;
     gl_Position     = u_ProjectionMatrix * Out.v_LightSpacePos;
 }
+#endif
@@ -0,0 +1,48 @@
+#version 430 core
+
+// Shadow test of the light texels with long lists (3rd_pass_shadow_test.fs with LOAD_BALANCING): one work group
+// per fragment, the samples of the list are split among its invocations. Persistent work groups loop over the
+// fragments handed over by the shadow test. The samples are tested by shadowTestSample() of alias_free_common.glsl.
+
+layout (local_size_x = 64) in;
+
+// Visibility map coordinates of the samples (x | y << 16)
+layout (std430, binding = 2) readonly buffer Samples {
+    uint samples[];
+};
+
+// Triangle of the fragment, the w components of the vertices hold the sample range and the layer (uint bits)
+struct HeavyList {
+    vec4 triangle_vertices[3];
+    vec4 plane;
+};
+
+// The counter exceeds the capacity of the buffer if the shadow test tested some long lists itself
+layout (std430, binding = 6) readonly buffer HeavyLists {
+    uint      num_heavy_lists;
+    HeavyList heavy_lists[];
+};
+
+void main(void) {
+
+    uint count = min(num_heavy_lists, uint(heavy_lists.length()));
+    for (uint list = gl_WorkGroupID.x; list < count; list += gl_NumWorkGroups.x) {
+
+        plane = heavy_lists[list].plane;
+        for (int i = 0; i < 3; i++)
+            triangle_vertices[i] = heavy_lists[list].triangle_vertices[i].xyz;
+        uint begin = floatBitsToUint(heavy_lists[list].triangle_vertices[0].w);
+        uint end   = floatBitsToUint(heavy_lists[list].triangle_vertices[1].w);
+        light_view = views[u_FirstView + int(floatBitsToUint(heavy_lists[list].triangle_vertices[2].w))];
+        if (u_EdgeFunctions)
+            setupEdgeFunctions();
+
+        for (uint index = begin + gl_LocalInvocationID.x; index < end; index += gl_WorkGroupSize.x) {
+
+            // Coordinates of point in the visibility map
+            ivec2 visibility_map_coord = ivec2(samples[index] & 0xFFFFU, samples[index] >> 16);
+
+            shadowTestSample(visibility_map_coord);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#version 430 core
+
+// Light space triangle records of the shadow test without the geometry shader (VERTEX_PULLING in 3rd_pass_shadow_test.vs
+// and 3rd_pass_shadow_test.fs), the same vertices and plane as 3rd_pass_shadow_test.gs passes to the fragments and the
+// edge functions of the shadow test (struct Triangle and setupEdgeFunctions() in alias_free_common.glsl)
+
+layout (local_size_x = 64) in;
+
+// Light view transformation
+layout (location = 0) uniform mat4 u_ModelViewMatrix;
+
+// Number of the scene triangles
+layout (location = 4) uniform uint u_NumTriangles;
+
+// Object space vertices of the scene captured by transform feedback (tightly packed vec3, 3 per triangle)
+layout (std430, binding = 9) readonly buffer SceneVertices {
+    float scene_vertices[];
+};
+
+layout (std430, binding = 8) writeonly buffer Triangles {
+    Triangle triangles[];
+};
+
+// Computes plane equation from three colinear points (ordered ccw)
+vec4 computePlane(vec3 a, vec3 b, vec3 c);
+
+void main(void) {
+
+    uint triangle = gl_GlobalInvocationID.x;
+    if (triangle >= u_NumTriangles)
+        return;
+
+    for (uint i = 0U; i < 3U; i++) {
+        uint vertex = 9U * triangle + 3U * i;
+        triangle_vertices[i] = (u_ModelViewMatrix * vec4(scene_vertices[vertex], scene_vertices[vertex + 1U], scene_vertices[vertex + 2U], 1.0)).xyz;
+        triangles[triangle].triangle_vertices[i] = vec4(triangle_vertices[i], 1.0);
+    }
+    plane = computePlane(triangle_vertices[0], triangle_vertices[1], triangle_vertices[2]);
+    setupEdgeFunctions();
+
+    triangles[triangle].plane = plane;
+    for (int i = 0; i < 3; i++)
+        triangles[triangle].edges[i] = edges[i];
+}
+
+vec4 computePlane(vec3 a, vec3 b, vec3 c) {
+    vec3 normal = normalize(cross(b - a, c - a));
+    return vec4(normal, dot(normal, a));
+}
@@ -16,11 +16,80 @@ layout (binding = 4, rgba8) uniform image2D lighting_map;
 // Shadow map generated in the previous pass
 layout (binding = 3, r32ui) uniform uimage2D shadow_map;
 
+// Generation of the current frame, shadow map texels of older frames are not in shadow
+layout (location = 5) uniform uint u_Generation;
+
+// Packed shadow results (shadowWord() and shadowBit() in alias_free_common.glsl)
+layout (std430, binding = 11) readonly buffer ShadowBits {
+    uint shadow_bits[];
+};
+layout (location = 20) uniform bool u_PackedShadows;
+layout (location = 21) uniform int  u_ShadowTilesX;
+layout (location = 22) uniform int  u_ShadowPlaneWords;
+
+// The cube faces of the point light mark the shadowed samples by a light mask instead of the generation
+layout (location = 26) uniform uint u_LightBit;
+
+uint shadowWord(ivec2 coord) {
+    return uint(coord.y >> 2) * uint(u_ShadowTilesX) + uint(coord.x >> 3);
+}
+
+uint shadowBit(ivec2 coord) {
+    return 1U << uint(((coord.y & 3) << 3) | (coord.x & 7));
+}
+
+// Several lights: the shadow map stores a mask of the lights in shadow (the packed results a bit plane per light),
+// the lighting map the albedo, and the view space position and normal come from the depth buffer and the normals of pass 1
+const int MAX_LIGHTS = 32;
+
+layout (binding = 5) uniform sampler2D depth_buffer;
+layout (binding = 6) uniform sampler2D normal_map;
+
+layout (location = 27) uniform int  u_NumLights;
+layout (location = 28) uniform mat4 u_InverseProjectionMatrix;
+layout (location = 32) uniform vec4 u_LightPositions[MAX_LIGHTS];
+
+uint lightMask(ivec2 coord) {
+    if (!u_PackedShadows) return imageLoad(shadow_map, coord).x;
+    uint mask = 0U;
+    for (int light = 0; light < u_NumLights; light++) {
+        if ((shadow_bits[uint(light * u_ShadowPlaneWords) + shadowWord(coord)] & shadowBit(coord)) != 0U) mask |= 1U << light;
+    }
+    return mask;
+}
+
+vec4 shadeLights(ivec2 coord) {
+    vec4  albedo = imageLoad(lighting_map, coord);
+    float depth  = texelFetch(depth_buffer, coord, 0).x;
+    if (depth == 1.0) return albedo;
+
+    vec2 ndc = (vec2(coord) + 0.5) / vec2(textureSize(depth_buffer, 0)) * 2.0 - 1.0;
+    vec4 p   = u_InverseProjectionMatrix * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vec3 N   = normalize(texelFetch(normal_map, coord, 0).xyz);
+
+    uint mask  = lightMask(coord);
+    vec4 color = vec4(0.0);
+    for (int light = 0; light < u_NumLights; light++) {
+        float NdotL = max(dot(N, normalize(u_LightPositions[light].xyz - p.xyz / p.w)), 0.0);
+        color += albedo * NdotL * ((((mask >> light) & 1U) != 0U) ? 0.2 : 1.0);
+    }
+    return color / float(u_NumLights);
+}
+
 void main() {
 
+    if (u_NumLights > 1) {
+        FragColor = shadeLights(ivec2(gl_FragCoord.xy));
+        return;
+    }
+
     vec4 shadow = vec4(1.0);
 
-    shadow = (imageLoad(shadow_map, ivec2(gl_FragCoord.xy)).x > 0) ? vec4(0.0) : vec4(1.0);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    uint  value    = u_PackedShadows ? 0U : imageLoad(shadow_map, coord).x;
+    bool  shadowed = u_PackedShadows ? (shadow_bits[shadowWord(coord)] & shadowBit(coord)) != 0U
+                                     : (u_LightBit != 0U) ? (value & u_LightBit) != 0U : value == u_Generation;
+    shadow = shadowed ? vec4(0.0) : vec4(1.0);
    
     // Modulate fragment's color according to result of shadow test
     FragColor = imageLoad(lighting_map, ivec2(gl_FragCoord.xy)) * max(vec4(0.2), shadow);
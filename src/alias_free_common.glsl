@@ -0,0 +1,498 @@
+// Code shared by the shaders of the alias-free shadow mapping passes. compileShaders() in controls.hpp prepends it to
+// the shaders of a program after the defines of the program, which select the parts of the code:
+//   CAMERA_SAMPLES    ... camera samples of pass 1 in the light view space (fetchCameraSample())
+//   LIST_GENERATION   ... light texel of the samples, receiver depth tiles and the linked list insertion of pass 2
+//                         (insertSample(), without COMPACTED_LIST)
+//   OCCLUDER_TRIANGLE ... occluder triangle of pass 3 and its edge functions (setupEdgeFunctions())
+//   SHADOW_TEST       ... shadow test of the samples against the occluder triangle of pass 3 (shadowTestSample()),
+//                         includes CAMERA_SAMPLES and OCCLUDER_TRIANGLE
+//   LAYERED           ... the shadow test draws the triangles to all layers of the batch of light views (gl_Layer)
+// Only the fragment and compute shaders get the code (the stage is defined by Tools::Shader::CreateShaderFromFile()),
+// except the light views, the triangle records of VERTEX_PULLING and CONSERVATIVE_RASTER, the triangle enlargement of
+// the shadow test, in its vertex and geometry shaders.
+
+#if defined(SHADOW_TEST) && !defined(CAMERA_SAMPLES)
+#define CAMERA_SAMPLES
+#endif
+#if defined(SHADOW_TEST) && !defined(OCCLUDER_TRIANGLE)
+#define OCCLUDER_TRIANGLE
+#endif
+
+// Light space triangle records written by 3rd_pass_triangle_setup.cs (the record size of the buffer is queried
+// from its program by setupLightSpaceTriangles() in shadow_mapping.cpp)
+struct Triangle {
+    vec4 triangle_vertices[3];
+    vec4 plane; // plane.xyz := n (plane normal), plane.w := d (dot(n,p) for a given point p on the plane)
+    vec4 edges[3];
+};
+
+#if defined(VERTEX_PULLING) && defined(VERTEX_SHADER)
+// Triangles of the vertex pulling shadow test, drawn without vertex attributes (3 vertices per record)
+layout (std430, binding = 8) readonly buffer Triangles {
+    Triangle triangles[];
+};
+#endif
+
+#if defined(CAMERA_SAMPLES) || defined(LIST_GENERATION)
+// Light views of the frame (the lights, cube faces or cascades, setLightViews() in shadow_mapping.cpp). They are
+// built in batches, the view u_FirstView + layer has its lists in the layer of the head pointer image and of the
+// other light texel buffers. A single light view has one layer.
+struct LightView {
+    mat4 sample_to_light;   // Stored samples (light view space of the main light) to the light view space
+    mat4 projection;
+    vec4 depth_plane;       // Camera distance of the stored samples (cascades, the same plane in every cascade)
+    vec2 depth_range;       // Camera distance range of the samples of the view, (0, 0) ... all samples
+    uint light_bit;         // Bit of the light in the light masks of the shadow map, 0 ... single light tagged by the generation
+    uint padding;
+};
+
+layout (std430, binding = 12) readonly buffer LightViews {
+    LightView views[];
+};
+
+// Samples in the lists of every view (several views only), the layered shadow test skips the views without samples
+layout (std430, binding = 13) buffer ViewSamples {
+    uint view_samples[];
+};
+
+layout (location = 23) uniform int  u_FirstView;
+layout (location = 24) uniform int  u_NumLayers;
+layout (location = 30) uniform int  u_NumViews;
+
+// The views are the cube faces of a point light, a sample belongs only to the face of its dominant axis
+layout (location = 25) uniform bool u_CubeFaces;
+#endif
+
+#if defined(LAYERED) && (defined(VERTEX_SHADER) || defined(GEOMETRY_SHADER))
+// Clip space triangle outside of one of the planes of the light frustum, it does not overlap the light texels of the view
+bool outsideLightFrustum(vec4 v0, vec4 v1, vec4 v2) {
+    vec3 x = vec3(v0.x, v1.x, v2.x);
+    vec3 y = vec3(v0.y, v1.y, v2.y);
+    vec3 z = vec3(v0.z, v1.z, v2.z);
+    vec3 w = vec3(v0.w, v1.w, v2.w);
+    return all(greaterThan(x, w)) || all(lessThan(x, -w)) || all(greaterThan(y, w)) || all(lessThan(y, -w)) ||
+           all(greaterThan(z, w)) || all(lessThan(z, -w));
+}
+#endif
+
+#if defined(FRAGMENT_SHADER) || defined(COMPUTE_SHADER)
+
+// Camera sample storage of pass 1 (eVisibilityEncoding in shadow_mapping.cpp)
+const int VISIBILITY_POSITIONS = 0;
+const int VISIBILITY_BUFFER    = 1;
+const int VISIBILITY_HALF      = 2;
+const int VISIBILITY_DEPTH     = 3;
+
+#ifdef CAMERA_SAMPLES
+// Camera samples of pass 1, light view space positions (fp32 or fp16), the visibility buffer (triangle index + 1, 0 for
+// empty pixels, and barycentrics of the 2nd and 3rd vertex as unorm16x2) resolved by the triangles of the triangle setup,
+// or the camera view space depth only (0 for empty pixels) unprojected to the light view space. The samples are stored
+// in the light view space of the main light, LightView.sample_to_light transforms them to the other views.
+layout (binding = 1) uniform sampler2D  visibility_map;
+layout (binding = 4) uniform usampler2D visibility_buffer;
+layout (location = 11) uniform int u_VisibilityEncoding;
+
+// Camera view space to light view space (light view * inverse camera view) and the inverse camera projection, the
+// linear depth keeps the fp32 precision along the view ray (the hyperbolic NDC depth loses it at the distance of the scene)
+layout (location = 12) uniform mat4 u_CameraToLightMatrix;
+layout (location = 16) uniform mat4 u_InverseProjectionMatrix;
+
+// Triangles of the visibility buffer, the vertex pulling shadow test reads the records of its primitives too
+layout (std430, binding = 8) readonly buffer Triangles {
+    Triangle triangles[];
+};
+
+// Stored light view space position of the sample of the pixel, w is 1 for the pixels covered by the scene
+vec4 fetchCameraSample(ivec2 coord) {
+    if (u_VisibilityEncoding == VISIBILITY_BUFFER) {
+        uvec2 item = texelFetch(visibility_buffer, coord, 0).xy;
+        if (item.x == 0U) return vec4(0.0);
+        vec2 b  = unpackUnorm2x16(item.y);
+        vec3 v0 = triangles[item.x - 1U].triangle_vertices[0].xyz;
+        vec3 v1 = triangles[item.x - 1U].triangle_vertices[1].xyz;
+        vec3 v2 = triangles[item.x - 1U].triangle_vertices[2].xyz;
+        return vec4(v0 + b.x * (v1 - v0) + b.y * (v2 - v0), 1.0);
+    }
+    if (u_VisibilityEncoding == VISIBILITY_DEPTH) {
+        float depth = texelFetch(visibility_map, coord, 0).x;
+        if (depth == 0.0) return vec4(0.0);
+        vec2 ndc = (vec2(coord) + 0.5) / vec2(textureSize(visibility_map, 0)) * 2.0 - 1.0;
+        vec4 ray = u_InverseProjectionMatrix * vec4(ndc, 1.0, 1.0);
+        return u_CameraToLightMatrix * vec4(ray.xyz * (depth / -ray.z), 1.0);
+    }
+    return texelFetch(visibility_map, coord, 0);
+}
+
+ivec2 cameraSampleSize() {
+    return (u_VisibilityEncoding == VISIBILITY_BUFFER) ? textureSize(visibility_buffer, 0) : textureSize(visibility_map, 0);
+}
+#endif
+
+#if defined(LIST_GENERATION) || defined(SHADOW_TEST)
+// Generation of the current frame, head pointers store it in the bits above the node index (pointers of older
+// generations terminate the list, so the head pointer image is not cleared every frame). NODE_INDEX_BITS is
+// defined by compileShaders() from the constant of shadow_mapping.cpp.
+layout (location = 5) uniform uint u_Generation;
+
+const uint NODE_INDEX_MASK = (1U << NODE_INDEX_BITS) - 1U;
+#endif
+
+#ifdef LIST_GENERATION
+// Receiver depth tiles (8x8 light texels of every layer), maximum light distance of the samples in the tile encoded
+// as generation << 24 | upper 24 bits of the float, values of older generations are smaller
+layout (binding = 5, r32ui) uniform uimage2DArray receiver_depth_tiles;
+layout (location = 6) uniform bool u_ReceiverDepthTiles;
+
+// Cube face of the dominant axis of the stored position (-z, +z, +x, -x, +y, -y, cubeFaceViewMatrix() in shadow_mapping.cpp)
+int cubeFace(vec3 p) {
+    vec3 a = abs(p);
+    if ((a.z >= a.x) && (a.z >= a.y)) return (p.z < 0.0) ? 0 : 1;
+    if (a.x >= a.y) return (p.x > 0.0) ? 2 : 3;
+    return (p.y > 0.0) ? 4 : 5;
+}
+
+// The cascades split the camera distance into consecutive ranges (the other views take all samples)
+bool cascadeViews() {
+    return views[u_FirstView].depth_range.y > 0.0;
+}
+
+// Copies of a sample in the lists of the batch, the lights insert it into every layer, a cube face or cascade takes it
+// alone (the list nodes and the compacted samples hold g_SampleCopies in shadow_mapping.cpp per pixel)
+int sampleCopies() {
+    return (u_CubeFaces || cascadeViews()) ? 1 : u_NumLayers;
+}
+
+// Layers of the batch [x, y) the stored sample can be inserted to, the other views are not tested
+ivec2 sampleLayers(vec3 sample_pos) {
+    if (u_CubeFaces) {
+        int layer = cubeFace(sample_pos) - u_FirstView;
+        return ((layer >= 0) && (layer < u_NumLayers)) ? ivec2(layer, layer + 1) : ivec2(0);
+    }
+
+    // A sample belongs only to the cascade of its camera distance
+    if (cascadeViews()) {
+        float camera_depth = dot(views[u_FirstView].depth_plane, vec4(sample_pos, 1.0));
+        for (int layer = 0; layer < u_NumLayers; layer++) {
+            vec2 depth_range = views[u_FirstView + layer].depth_range;
+            if ((camera_depth >= depth_range.x) && (camera_depth < depth_range.y)) return ivec2(layer, layer + 1);
+        }
+        return ivec2(0);
+    }
+    return ivec2(0, u_NumLayers);
+}
+
+// Light texel of the stored sample in the light texel grid of the resolution and its light view space position in
+// the view of the layer, false for the samples outside of the light frustum, behind the light too (they would be
+// mirrored into it)
+bool lightTexel(int layer, vec3 sample_pos, int resolution, out ivec2 texel_coord, out vec3 light_pos) {
+
+    LightView view = views[u_FirstView + layer];
+    light_pos = (view.sample_to_light * vec4(sample_pos, 1.0)).xyz;
+    vec4 light_clip_pos = view.projection * vec4(light_pos, 1.0);
+    vec2 light_ndc      = light_clip_pos.xy / light_clip_pos.w;
+    if ((light_clip_pos.w <= 0.0) || any(greaterThan(abs(light_ndc), vec2(1.0)))) return false;
+
+    // Get view plane coordinates
+    vec2 light_sample_coord = light_ndc * 0.5 + 0.5;
+    texel_coord = ivec2(light_sample_coord * vec2(resolution));
+    return true;
+}
+
+// Light distance of the sample rounded up, samples behind the light disable the rejection in their tile
+void updateReceiverDepthTile(ivec2 texel_coord, int layer, vec3 light_pos) {
+    if (u_ReceiverDepthTiles) {
+        uint depth = (light_pos.z < 0.0) ? (floatBitsToUint(-light_pos.z) >> 8) + 1U : 0xFFFFFFU;
+        imageAtomicMax(receiver_depth_tiles, ivec3(texel_coord >> 3, layer), (u_Generation << 24) | depth);
+    }
+}
+
+// Sample inserted into the lists of the view of the layer
+void countViewSample(int layer) {
+    if (u_NumViews > 1)
+        atomicAdd(view_samples[u_FirstView + layer], 1U);
+}
+
+#ifndef COMPACTED_LIST
+#ifndef PIXEL_NODE_INDEX
+// This is the atomic counter used to allocate items in the linked list, it is reset only with the full clear of the head pointers
+layout (binding = 0, offset = 0) uniform atomic_uint list_counter;
+#endif
+
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+// Linked list nodes, only the pointer to the next node is stored (the node index is the pixel index)
+layout (std430, binding = 3) writeonly buffer ListNodes {
+    uint nodes[];
+};
+#elif defined(COMPACT_NODES)
+// Linked list nodes (pointer to the next node, visibility map coordinates x | y << 16)
+layout (std430, binding = 3) writeonly buffer ListNodes {
+    uvec2 nodes[];
+};
+#else
+// Linked list 1D buffer
+layout (binding = 2, rgba32ui) uniform writeonly uimageBuffer list_buffer;
+#endif
+
+// Head pointers of the layers
+layout (binding = 1, r32ui) uniform uimage2DArray head_pointer_image;
+
+// Inserts the stored sample of the visibility map pixel into the linked lists of its light texels in the layers of
+// the batch, the list capacity is one node per pixel of the visibility map of the size and sample copy
+void insertSample(ivec2 coord, vec3 sample_pos, ivec2 size) {
+
+    uint  pixels = uint(size.x * size.y);
+    int   copies = sampleCopies();
+    ivec2 layers = sampleLayers(sample_pos);
+    for (int layer = layers.x; layer < layers.y; layer++) {
+
+        ivec2 texel_coord;
+        vec3  light_pos;
+        if (!lightTexel(layer, sample_pos, imageSize(head_pointer_image).x, texel_coord, light_pos)) continue;
+        countViewSample(layer);
+
+#ifdef PIXEL_NODE_INDEX
+        // Every pixel owns one node of the list buffer per copy (the copies of the lights follow each other), no
+        // allocation needed and the node of a sample is the same every frame
+        uint index = uint((copies > 1) ? layer : 0) * pixels + uint(coord.y) * uint(size.x) + uint(coord.x);
+#else
+        // Allocate an index in the linked list buffer (one node per pixel and copy, the counter keeps running across the frames)
+        uint index = atomicCounterIncrement(list_counter) % (pixels * uint(copies));
+#endif
+
+        // Insert the sample into the list - atomically exchange newly allocated index with the current content of the head pointer image
+        uint head_ptr     = (u_Generation << NODE_INDEX_BITS) | index;
+        uint old_head_ptr = imageAtomicExchange(head_pointer_image, ivec3(texel_coord, layer), head_ptr);
+
+        updateReceiverDepthTile(texel_coord, layer, light_pos);
+
+#ifdef PIXEL_NODE_INDEX
+        // Coplanar fragments of the same pixel both pass the GL_EQUAL test of the fused list generation, the second
+        // insertion must not link the node to itself
+        if (old_head_ptr == head_ptr) continue;
+#endif
+
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+        nodes[index] = old_head_ptr;
+#elif defined(COMPACT_NODES)
+        nodes[index] = uvec2(old_head_ptr, uint(coord.x) | (uint(coord.y) << 16));
+#else
+        // head_pointer_image(x,y) -> new_item (.x) -> old_item, the visibility map coordinates of the sample (.yz) and
+        // the point does not lie in shadow by default (.w)
+        imageStore(list_buffer, int(index), uvec4(old_head_ptr, uvec2(coord), 0U));
+#endif
+    }
+}
+#endif
+#endif
+
+#ifdef OCCLUDER_TRIANGLE
+// Occluder triangle of the triangle setup and the shadow test
+vec4 plane;
+vec3 triangle_vertices[3];
+vec4 edges[3];
+
+// Edge planes through the light (origin) oriented to the inside of the triangle, w components hold the plane scaled
+// to dot(q, x) == 1 (SetupEdgeFunctions() in cpu/alias_free_cpu.h)
+void setupEdgeFunctions() {
+    vec3 v0 = triangle_vertices[0];
+    vec3 v1 = triangle_vertices[1];
+    vec3 v2 = triangle_vertices[2];
+    float s = (dot(v0, cross(v1, v2)) < 0.0) ? -1.0 : 1.0;
+    vec3  q = (plane.w != 0.0) ? plane.xyz / plane.w : vec3(0.0);
+    edges[0] = vec4(s * cross(v0, v1), q.x);
+    edges[1] = vec4(s * cross(v1, v2), q.y);
+    edges[2] = vec4(s * cross(v2, v0), q.z);
+}
+#endif
+
+#ifdef SHADOW_TEST
+// Shadow map 2D texture, texels in shadow store the generation of the current frame
+layout (binding = 3, r32ui) uniform uimage2D shadow_map;
+
+// Packed shadow results instead of the shadow map, one bit per pixel and a word per 8x4 pixel tile (tiles in rows),
+// cleared every frame instead of tagged by the generation
+layout (std430, binding = 11) buffer ShadowBits {
+    uint shadow_bits[];
+};
+layout (location = 20) uniform bool u_PackedShadows;
+layout (location = 21) uniform int  u_ShadowTilesX;
+layout (location = 22) uniform int  u_ShadowPlaneWords;
+
+// View of the occluder triangle and the tested samples (the layer of the fragment or of the heavy list). Several
+// lights share the samples, the shadow map then stores a mask of the lights in shadow (cleared every frame) and the
+// shadow test of a light sets its light_bit, 0 ... single light tagged by the generation
+LightView light_view;
+
+// The packed results of several lights are bit planes of u_ShadowPlaneWords words, the plane of the light bit
+uint shadowWord(ivec2 coord) {
+    uint plane = (light_view.light_bit != 0U) ? uint(findLSB(light_view.light_bit)) : 0U;
+    return plane * uint(u_ShadowPlaneWords) + uint(coord.y >> 2) * uint(u_ShadowTilesX) + uint(coord.x >> 3);
+}
+
+uint shadowBit(ivec2 coord) {
+    return 1U << uint(((coord.y & 3) << 3) | (coord.x & 7));
+}
+
+// Sample already in shadow of the current light in this frame
+bool sampleShadowed(ivec2 coord) {
+    if (u_PackedShadows) return (shadow_bits[shadowWord(coord)] & shadowBit(coord)) != 0U;
+    uint value = imageLoad(shadow_map, coord).x;
+    return (light_view.light_bit != 0U) ? (value & light_view.light_bit) != 0U : value == u_Generation;
+}
+
+void storeShadow(ivec2 coord) {
+    if (u_PackedShadows)
+        atomicOr(shadow_bits[shadowWord(coord)], shadowBit(coord));
+    else if (light_view.light_bit != 0U)
+        imageAtomicOr(shadow_map, coord, light_view.light_bit);
+    else
+        imageStore(shadow_map, coord, uvec4(u_Generation));
+}
+
+// Samples already in shadow in this frame are not tested again
+layout (location = 8) uniform bool u_SkipShadowed;
+
+// Ray tests, visits of samples already in shadow (tested again without u_SkipShadowed) and shadow map stores,
+// counted only with u_CountRayTests
+layout (std430, binding = 7) buffer RayTestCounters {
+    uint ray_tests;
+    uint shadowed_visits;
+    uint shadow_stores;
+};
+layout (location = 9) uniform bool u_CountRayTests;
+
+const float SHADOW_ACNE_EPSILON = 0.0001;
+
+// Shadow test by the edge functions instead of the plane intersection
+layout (location = 10) uniform bool u_EdgeFunctions;
+
+// Directional light (orthographic light projection), the shadow rays are parallel to the light view direction
+layout (location = 29) uniform bool u_Directional;
+
+// Direction of the shadow ray from the point p to the light
+vec3 shadowRay(vec3 p) {
+    return u_Directional ? vec3(0.0, 0.0, 1.0) : -p;
+}
+
+// Test if point p lies inside the ccw triangle
+bool pointInsideTriangle(vec3 p) {
+
+    // Translate point and triangle so that point lies at origin
+    vec3 a = triangle_vertices[0] - p;
+    vec3 b = triangle_vertices[1] - p;
+    vec3 c = triangle_vertices[2] - p;
+    float ab = dot(a, b);
+    float ac = dot(a, c);
+    float bc = dot(b, c);
+    float cc = dot(c, c);
+
+    // Make sure plane normals for triangles pab and pbc point in the same direction
+    if (bc * ac - cc * ab < 0.0) return false;
+
+    // Make sure plane normals for triangles pab and pca point in the same direction
+    float bb = dot(b, b);
+    if (ab * bc - ac * bb < 0.0) return false;
+
+    // Otherwise p must be in or on the triangle
+    return true;
+}
+
+// Test if shadow ray starting from the point a in the direction v intersects triangle
+bool intersectRayTriangle(vec3 a, vec3 v) {
+
+    // Intersect plane
+    float t = (plane.w - dot(plane.xyz, a)) / dot(plane.xyz, v);
+
+    if (0.0 <= t) {
+        // Plane was intersected, check if the intersection lies inside the triangle
+        return pointInsideTriangle(a + t * v);
+    }
+
+    return false;
+}
+
+// Same result as intersectRayTriangle() for the shadow ray of the point p by the edge functions of the triangle
+bool edgeFunctionsOccluded(vec3 p) {
+
+    // Light ray through the triangle
+    if (dot(edges[0].xyz, p) < 0.0) return false;
+    if (dot(edges[1].xyz, p) < 0.0) return false;
+    if (dot(edges[2].xyz, p) < 0.0) return false;
+
+    // The ray hits the plane at p / w, between the light and the ray origin offset by SHADOW_ACNE_EPSILON
+    float w = dot(vec3(edges[0].w, edges[1].w, edges[2].w), p);
+    return w * (1.0 - SHADOW_ACNE_EPSILON * inversesqrt(dot(p, p))) >= 1.0;
+}
+
+// Shadow test of the sample of the visibility map pixel against the occluder triangle
+void shadowTestSample(ivec2 visibility_map_coord) {
+
+    // The shadow map marks the samples resolved by earlier occluders (a store not yet visible only costs a test)
+    bool shadowed = (u_SkipShadowed || u_CountRayTests) && sampleShadowed(visibility_map_coord);
+    if (u_CountRayTests && shadowed) atomicAdd(shadowed_visits, 1U);
+    if (shadowed && u_SkipShadowed) return;
+    if (u_CountRayTests) atomicAdd(ray_tests, 1U);
+
+    // Transform the stored point to the light space of the view
+    vec4 p = fetchCameraSample(visibility_map_coord);
+    p.xyz = (light_view.sample_to_light * vec4(p.xyz, 1.0)).xyz;
+
+    // Test if the sample lies in shadow, the invocations testing the same sample store the same value
+    bool occluded = u_EdgeFunctions ? edgeFunctionsOccluded(p.xyz)
+                                    : intersectRayTriangle(p.xyz + normalize(shadowRay(p.xyz)) * SHADOW_ACNE_EPSILON, shadowRay(p.xyz));
+    if (occluded) {
+        storeShadow(visibility_map_coord);
+        if (u_CountRayTests) atomicAdd(shadow_stores, 1U);
+    }
+}
+#endif
+
+#endif
+
+#if defined(CONSERVATIVE_RASTER) && (defined(VERTEX_SHADER) || defined(GEOMETRY_SHADER))
+// Emulation of NV_conservative_raster in the shadow test, every light texel overlapped by the triangle has to be
+// visited: the edges of the clip space triangle are moved out by half a texel towards the farthest texel corner and
+// the fragment shader discards the texels outside of the bounding box of the triangle (Hasselgren et al., Conservative
+// Rasterization, GPU Gems 2). The extra texels only cost list traversals, the shadow rays of their samples miss the
+// triangle. Triangles crossing the plane of the light (w <= 0) are not enlarged.
+
+// Light texel grid resolution
+layout (location = 2) uniform int u_Resolution;
+
+// Vertex v of the clip space triangle (prev, v, next) moved to the intersection of its enlarged edges
+vec4 conservativeVertex(vec4 prev, vec4 v, vec4 next) {
+    if (min(min(prev.w, v.w), next.w) <= 0.0) return v;
+
+    // Edge lines a * x + b * y + c * w = 0 in the homogeneous 2D coordinates, positive inside of the triangle
+    float orientation = dot(cross(prev.xyw, v.xyw), next.xyw);
+    if (orientation == 0.0) return v;
+    vec3 e0 = cross(prev.xyw, v.xyw) * sign(orientation);
+    vec3 e1 = cross(v.xyw, next.xyw) * sign(orientation);
+
+    // Half a texel in NDC along both axes
+    float half_texel = 1.0 / float(u_Resolution);
+    e0.z += half_texel * (abs(e0.x) + abs(e0.y));
+    e1.z += half_texel * (abs(e1.x) + abs(e1.y));
+    vec3 moved = cross(e0, e1);
+    if (moved.z == 0.0) return v;
+    vec2 ndc = moved.xy / moved.z;
+
+    // Depth of the triangle plane at the moved vertex (affine in NDC), kept inside of the clip volume
+    vec3 n0 = prev.xyz / prev.w;
+    vec3 n1 = v.xyz / v.w;
+    vec3 n2 = next.xyz / next.w;
+    vec3 normal = cross(n0 - n1, n2 - n1);
+    float depth = (normal.z != 0.0) ? n1.z - dot(normal.xy, ndc - n1.xy) / normal.z : n1.z;
+
+    return vec4(ndc, clamp(depth, -1.0, 1.0), 1.0) * v.w;
+}
+
+// Bounding box of the clip space triangle in light texels (min.xy, max.xy)
+vec4 conservativeBounds(vec4 v0, vec4 v1, vec4 v2) {
+    if (min(min(v0.w, v1.w), v2.w) <= 0.0) return vec4(0.0, 0.0, vec2(u_Resolution));
+    vec2 p0 = (v0.xy / v0.w * 0.5 + 0.5) * float(u_Resolution);
+    vec2 p1 = (v1.xy / v1.w * 0.5 + 0.5) * float(u_Resolution);
+    vec2 p2 = (v2.xy / v2.w * 0.5 + 0.5) * float(u_Resolution);
+    return vec4(min(min(p0, p1), p2), max(max(p0, p1), p2));
+}
+#endif
@@ -13,6 +13,37 @@ CONTROLS:\n\
    [d/D]   ... change depth map resolution\n\
    [c]     ... compile shaders\n\
    [mouse] ... scene rotation (left button)\n\
+COMMAND LINE:\n\
+   --headless [N] ... render N frames (default 10) offscreen without window\n\
+   --alias-free   ... start with alias-free shadow maps algorithm\n\
+   --cpu          ... start with alias-free shadow maps computed on CPU\n\
+   --compare      ... compare CPU and GPU shadow maps (with --cpu), exit code 6 above the mismatch bound\n\
+   --gpu-samples  ... CPU shadow test on the visibility map of the GPU (with --cpu)\n\
+   --compacted    ... store light texel lists compacted by prefix sum (CSR)\n\
+   --pixel-nodes  ... linked list node index given by the pixel (no atomic counter)\n\
+   --compact-nodes ... 8 byte linked list nodes (4 bytes with --pixel-nodes)\n\
+   --fused-lists  ... linked lists built by the visibility pass after a depth prepass\n\
+   --depth-prepass ... depth-only prepass, the scene is shaded only at visible fragments\n\
+   --overdraw-stats ... scene shading fragment invocations per covered pixel\n\
+   --visibility-buffer ... pass 1 stores triangle index and barycentrics instead of positions\n\
+   --half-positions ... pass 1 stores fp16 positions\n\
+   --depth-samples ... pass 1 stores the camera view space depth only, positions are reconstructed\n\
+   --encoding-error ... misclassified shadow pixels of the compact encodings against fp32 positions\n\
+   --packed-shadows ... shadow results as one bit per pixel (8x4 pixel tiles per word) instead of R32UI\n\
+   --lights N ......... N shadowing lights sharing the visibility map (alias-free on GPU, 1 ... 32)\n\
+   --light X,Y,Z ...... position of the next additional light, it looks at the origin (repeatable, adds to --lights)\n\
+   --point-light ...... omnidirectional light, six cube faces sharing the visibility map (alias-free on GPU)\n\
+   --cascades N ....... directional light with N orthographic cascades of the camera distance (alias-free on GPU, 1 ... 4)\n\
+   --generation-tags ... head pointers and shadow map tagged by the frame generation instead of cleared every frame\n\
+   --occupancy-stencil ... shadow test only over the non-empty light texels (stencil buffer)\n\
+   --depth-tiles  ... occluder fragments behind all receivers of their tile rejected (receiver depth tiles)\n\
+   --light-fit M  ... light frustum fitting (fixed, gpu, cpu; default fixed)\n\
+   --auto-resolution ... light grid resolution chosen by the mean list length\n\
+   --skip-shadowed ... shadow test skips the samples already in shadow in this frame\n\
+   --vertex-pulling ... shadow test pulls light space triangle records instead of running the geometry shader\n\
+   --edge-functions ... shadow rays tested by the precomputed edge functions instead of the plane intersection\n\
+   --load-balancing ... long compacted lists tested by compute work groups\n\
+   --list-stats [F] ... light texel list length histogram (CSV rows appended to file F)\n\
 -------------------------------------------------------------------------------";
 
 // IMPLEMENTATION______________________________________________________________
@@ -34,6 +65,18 @@ void updateLightViewMatrix() {
 // Desc: 
 //-----------------------------------------------------------------------------
 void compileShaders(void *clientData) {
+    // Code shared by the shaders of the alias-free passes, prepended after the defines of the program
+    char* common_source = Tools::ReadFile("alias_free_common.glsl");
+    const std::string common_code = common_source ? common_source : "";
+    delete[] common_source;
+    // Head pointer layout shared with the C++ side (generation << NODE_INDEX_BITS | node index) and the layers of a
+    // batch of light views
+    const std::string constants = "#define NODE_INDEX_BITS " + std::to_string(NODE_INDEX_BITS) + "U\n#define MAX_VIEW_LAYERS " +
+                                  std::to_string(MAX_VIEW_LAYERS) + "\n";
+    auto common = [&common_code, &constants](const std::string& defines) { return defines + constants + common_code; };
+    // Without NV_conservative_raster the shadow test enlarges the triangles itself
+    const std::string shadow_test = GLEW_NV_conservative_raster ? "#define SHADOW_TEST\n" : "#define SHADOW_TEST\n#define CONSERVATIVE_RASTER\n";
+
     // Create shader program object
 
     Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[DepthTextureGeneration],
@@ -42,13 +85,97 @@ void compileShaders(void *clientData) {
         nullptr, nullptr, nullptr, "shadow_mapping_2nd_pass.fs");
 
     Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFree],
-        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs");
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test).c_str());
     Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[RenderScene], "4th_pass_render_scene.vs",
         nullptr, nullptr, nullptr, "4th_pass_render_scene.fs");
     Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityMapGeneration], "1st_pass_visibility_map_generation.vs",
-        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs");
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", common("").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[DepthPrepass], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "depth_only.fs");
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityBufferGeneration], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", "#define VISIBILITY_BUFFER\n");
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityBufferPrepass], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "depth_only.fs", "#define VISIBILITY_BUFFER\n");
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[DepthPrepassStandard], "shadow_mapping_2nd_pass.vs",
+        nullptr, nullptr, nullptr, "depth_only.fs");
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[CoveredPixels], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "depth_only.fs");
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityMapGenerationFused], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", common("#define LIST_GENERATION\n#define FUSED_LIST_GENERATION\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityMapGenerationFusedPixelNodes], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", common("#define LIST_GENERATION\n#define FUSED_LIST_GENERATION\n#define PIXEL_NODE_INDEX\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityMapGenerationFusedCompactNodes], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", common("#define LIST_GENERATION\n#define FUSED_LIST_GENERATION\n#define COMPACT_NODES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[VisibilityMapGenerationFusedCompactPixelNodes], "1st_pass_visibility_map_generation.vs",
+        nullptr, nullptr, nullptr, "1st_pass_visibility_map_generation.fs", common("#define LIST_GENERATION\n#define FUSED_LIST_GENERATION\n#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n").c_str());
     Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ListBufferGeneration], "2nd_pass_list_buffer_generation.vs",
-        nullptr, nullptr, nullptr, "2nd_pass_list_buffer_generation.fs");
+        nullptr, nullptr, nullptr, "2nd_pass_list_buffer_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ListBufferGenerationPixelNodes], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "2nd_pass_list_buffer_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n#define PIXEL_NODE_INDEX\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ListBufferGenerationCompactNodes], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "2nd_pass_list_buffer_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n#define COMPACT_NODES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ListBufferGenerationCompactPixelNodes], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "2nd_pass_list_buffer_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n").c_str());
+
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[CompactedListCount], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "2nd_pass_compacted_list_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n#define COMPACTED_LIST\n#define COUNT_SAMPLES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[CompactedListScatter], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, nullptr, "2nd_pass_compacted_list_generation.fs", common("#define CAMERA_SAMPLES\n#define LIST_GENERATION\n#define COMPACTED_LIST\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompacted],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test + "#define COMPACTED_LIST\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactNodes],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test + "#define COMPACT_NODES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactPixelNodes],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test + "#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[LightTexelOccupancy], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, "2nd_pass_light_texel_occupancy.gs", "2nd_pass_light_texel_occupancy.fs", constants.c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[LightTexelOccupancyCompacted], "2nd_pass_list_buffer_generation.vs",
+        nullptr, nullptr, "2nd_pass_light_texel_occupancy.gs", "2nd_pass_light_texel_occupancy.fs", (constants + "#define COMPACTED_LIST\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ReceiverDepthTilesReduce], "receiver_depth_tiles.cs");
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[LightFrustumBounds], "light_frustum_bounds.cs", common("#define CAMERA_SAMPLES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactedBalanced],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test + "#define COMPACTED_LIST\n#define LOAD_BALANCING\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ShadowTestHeavyLists], "3rd_pass_shadow_test_heavy_lists.cs", common("#define SHADOW_TEST\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreePulled],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr, "3rd_pass_shadow_test.fs", common(shadow_test + "#define VERTEX_PULLING\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactedPulled],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr, "3rd_pass_shadow_test.fs", common(shadow_test + "#define VERTEX_PULLING\n#define COMPACTED_LIST\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactNodesPulled],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr, "3rd_pass_shadow_test.fs", common(shadow_test + "#define VERTEX_PULLING\n#define COMPACT_NODES\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactPixelNodesPulled],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr, "3rd_pass_shadow_test.fs", common(shadow_test + "#define VERTEX_PULLING\n#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n").c_str());
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeCompactedBalancedPulled],
+        "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr, "3rd_pass_shadow_test.fs", common(shadow_test + "#define VERTEX_PULLING\n#define COMPACTED_LIST\n#define LOAD_BALANCING\n").c_str());
+
+    // Shadow test of a batch of light views (the order of the variants above), the geometry shader invocations or the
+    // vertex pulling instances draw the triangles to the layers
+    const char* layered_variants[5] = { "", "#define COMPACTED_LIST\n", "#define COMPACT_NODES\n", "#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n",
+                                        "#define COMPACTED_LIST\n#define LOAD_BALANCING\n" };
+    const std::string layer_extension = "#ifdef VERTEX_SHADER\n#extension GL_ARB_shader_viewport_layer_array : require\n#endif\n";
+    for (int variant = 0; variant < 5; variant++)
+    {
+        Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreeLayered + variant],
+            "3rd_pass_shadow_test.vs", nullptr, nullptr, "3rd_pass_shadow_test.gs", "3rd_pass_shadow_test.fs", common(shadow_test + "#define LAYERED\n" + layered_variants[variant]).c_str());
+        if (GLEW_ARB_shader_viewport_layer_array)
+            Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[ShadowTestAliasFreePulledLayered + variant], "3rd_pass_shadow_test.vs", nullptr, nullptr, nullptr,
+                "3rd_pass_shadow_test.fs", common(layer_extension + shadow_test + "#define VERTEX_PULLING\n#define LAYERED\n" + layered_variants[variant]).c_str());
+    }
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[TriangleSetup], "3rd_pass_triangle_setup.cs", common("#define OCCLUDER_TRIANGLE\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ListStatistics], "list_statistics.cs", constants.c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ListStatisticsCompactNodes], "list_statistics.cs", (constants + "#define COMPACT_NODES\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ListStatisticsCompactPixelNodes], "list_statistics.cs", (constants + "#define COMPACT_NODES\n#define PIXEL_NODE_INDEX\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[ListStatisticsCompacted], "list_statistics.cs", (constants + "#define COMPACTED_LIST\n").c_str());
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[PrefixSumBlocks], "prefix_sum.cs");
+    Tools::Shader::CreateComputeProgramFromFile(g_ProgramId[PrefixSumAdd], "prefix_sum.cs", "#define ADD_BLOCK_SUMS\n");
+
+    // Positions into the first buffer, shading attributes into the second one
+    std::vector<char*> capture_varyings;
+    capture_varyings.push_back(const_cast<char*>("v_Position"));
+    capture_varyings.push_back(const_cast<char*>("gl_NextBuffer"));
+    capture_varyings.push_back(const_cast<char*>("v_Normal"));
+    capture_varyings.push_back(const_cast<char*>("v_TexCoord"));
+    Tools::Shader::CreateShaderProgramFromFile(g_ProgramId[SceneCapture], "scene_capture.vs",
+        nullptr, nullptr, nullptr, nullptr, nullptr, &capture_varyings);
 }
 
 
@@ -69,29 +196,156 @@ void showGUI(void* user) {
         if (ImGui::Combo("resolution", &resolution, " 128x128 \0 256x256\0 512x512 \0 1024x1024\0 2048x2048\0")) {
             g_Resolution = 128 << resolution;
         }
+        ImGui::Checkbox("auto resolution", &g_AutoResolution);
+        if (g_AutoResolution)
+            ImGui::Text("mean list length: %.2f", g_MeanListLength);
     }
 
     if (ImGui::CollapsingHeader("Shadow maps", ImGuiTreeNodeFlags_DefaultOpen))
     {
         int algorithm = g_ShadowMapsAlgo;
         ImGui::SetNextItemWidth(120);
-        if (ImGui::Combo("Algorithm", &algorithm, " Depth Map\0 Alias-Free\0"))
+        if (ImGui::Combo("Algorithm", &algorithm, " Depth Map\0 Alias-Free\0 Alias-Free (CPU)\0"))
         {
             if (g_ShadowMapsAlgo != algorithm) g_Switch = true;
             g_ShadowMapsAlgo = algorithm;
         }
+        if ((g_ShadowMapsAlgo == 1) || g_CPUCompare)
+        {
+            ImGui::SetNextItemWidth(120);
+            ImGui::Combo("Lists", &g_ListMode, " Linked\0 Compacted\0");
+            if (!g_LinkedListsAddressable) g_ListMode = CompactedList;
+            if (g_ListMode == LinkedList)
+            {
+                // Node storage depends on the format, buffers are recreated
+                if (ImGui::Checkbox("node per pixel", &g_PixelNodeIndex)) g_Switch = true;
+                if (ImGui::Checkbox("compact nodes", &g_CompactNodes)) g_Switch = true;
+                ImGui::Checkbox("fused list generation", &g_FusedListGeneration);
+                ImGui::Text("list nodes: %.1f MB", g_ListNodeBytes / 1048576.0);
+            }
+            else
+            {
+                ImGui::Checkbox("load balancing", &g_LoadBalancing);
+            }
+            ImGui::Checkbox("generation tags", &g_GenerationTags);
+            ImGui::Checkbox("occupancy stencil", &g_OccupancyStencil);
+            ImGui::Checkbox("receiver depth tiles", &g_ReceiverDepthTiles);
+            ImGui::Checkbox("skip shadowed samples", &g_SkipShadowed);
+            ImGui::Checkbox("vertex pulling", &g_VertexPulling);
+            ImGui::Checkbox("edge functions", &g_EdgeFunctions);
+            ImGui::Checkbox("list statistics", &g_ListStatistics);
+            if (GLEW_ARB_pipeline_statistics_query)
+                ImGui::Text("shadow test FS: %u", g_ShadowTestInvocations.get());
+        }
+        if (g_ShadowMapsAlgo != 0)
+        {
+            // Format of the visibility map, textures are recreated
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::Combo("Samples", &g_VisibilityEncoding, " Positions\0 Visibility buffer\0 fp16 positions\0 Depth\0")) g_Switch = true;
+            if (g_VisibilityEncoding != VisibilityPositions)
+            {
+                if (ImGui::Checkbox("encoding error", &g_EncodingError)) g_Switch = true;
+                if (g_EncodingError)
+                    ImGui::Text("misclassified: %u", g_EncodingErrorStats.misclassified);
+            }
+            // Shadow result storage, the shadow map is recreated
+            if (ImGui::Checkbox("packed shadows", &g_PackedShadows)) g_Switch = true;
+            // Additional lights share the samples, the normals, list nodes and packed bit planes are recreated
+            if ((g_ShadowMapsAlgo == 1) && !g_PointLight && (g_NumCascades == 0))
+            {
+                ImGui::SetNextItemWidth(120);
+                if (ImGui::SliderInt("lights", &g_NumLights, 1, MAX_LIGHTS)) g_Switch = true;
+            }
+            // Cube faces of an omnidirectional light (samples per face, the layered shadow test skips the empty faces)
+            if (g_ShadowMapsAlgo == 1)
+            {
+                ImGui::Checkbox("point light", &g_PointLight);
+                if (g_PointLight)
+                    ImGui::Text("face samples: %u %u %u %u %u %u", g_ViewSampleCounts[0], g_ViewSampleCounts[1], g_ViewSampleCounts[2],
+                                g_ViewSampleCounts[3], g_ViewSampleCounts[4], g_ViewSampleCounts[5]);
+            }
+            // Directional light, cascades of the camera distance (0 ... spot light)
+            if ((g_ShadowMapsAlgo == 1) && !g_PointLight)
+            {
+                ImGui::SetNextItemWidth(120);
+                ImGui::SliderInt("cascades", &g_NumCascades, 0, MAX_CASCADES);
+                if (g_NumCascades > 1)
+                    ImGui::Text("cascade samples: %u %u %u %u", g_ViewSampleCounts[0], g_ViewSampleCounts[1], g_ViewSampleCounts[2], g_ViewSampleCounts[3]);
+            }
+            ImGui::SetNextItemWidth(120);
+            ImGui::Combo("Light fit", &g_LightFit, " Fixed\0 GPU (async)\0 CPU\0");
+            if (g_OccupancyStencil && ((g_ShadowMapsAlgo == 1) || g_CPUCompare))
+                ImGui::Text("occupied texels: %.2f %%", 100.0 * g_OccupiedTexels.get() / (g_Resolution * g_Resolution));
+        }
+        // Shading of the camera view in both algorithms (visibility pass or standard shadow test)
+        ImGui::Checkbox("depth prepass", &g_DepthPrepass);
+        if (GLEW_ARB_pipeline_statistics_query)
+        {
+            ImGui::Checkbox("overdraw statistics", &g_OverdrawStatistics);
+            if (g_OverdrawStatistics && (g_CoveredPixels.get() > 0))
+                ImGui::Text("overdraw: %.2f", double(g_SceneInvocations.get()) / g_CoveredPixels.get());
+        }
+        if (g_ShadowMapsAlgo == 2)
+        {
+            ImGui::Checkbox("GPU visibility map", &g_CPUUseGPUSamples);
+            ImGui::Checkbox("compare with GPU", &g_CPUCompare);
+            if (g_CPUEngine)
+            {
+                const AliasFreeCPU::Statistics& stat = g_CPUEngine->getStatistics();
+                ImGui::Text("threads: %u", g_CPUEngine->getThreadCount());
+                ImGui::Text("shadow test: %.2f ms", stat.time[2]);
+                if (g_CPUCompare)
+                    ImGui::Text("mismatches: %u (bound %u), GPU samples: %u (bound %u)", g_CPUMismatches, g_CPUMismatchBound,
+                                g_CPUPassMismatches, g_CPUPassMismatchBound);
+            }
+        }
     }
 
     if (ImGui::CollapsingHeader("Light", ImGuiTreeNodeFlags_DefaultOpen)) {
+        // Position of the main light or of one of the additional lights
+        static int light = 0;
+        light = glm::min(light, g_NumLights - 1);
+        if (g_NumLights > 1) {
+            ImGui::SetNextItemWidth(190);
+            ImGui::SliderInt("light", &light, 0, g_NumLights - 1);
+        }
+        glm::vec3& position = (light == 0) ? g_LightPosition : g_LightPositions[light];
         ImGui::SetNextItemWidth(190);
-        ImGui::SliderFloat("x", &g_LightPosition.x, -30.0f, 30.0f, "%.3f");
+        ImGui::SliderFloat("x", &position.x, -30.0f, 30.0f, "%.3f");
         ImGui::SetNextItemWidth(190);
-        ImGui::SliderFloat("y", &g_LightPosition.y, -30.0f, 30.0f, "%.3f");
+        ImGui::SliderFloat("y", &position.y, -30.0f, 30.0f, "%.3f");
         ImGui::SetNextItemWidth(190);
-        ImGui::SliderFloat("z", &g_LightPosition.z, -30.0f, 30.0f, "%.3f");
+        ImGui::SliderFloat("z", &position.z, -30.0f, 30.0f, "%.3f");
     }
 
     ImGui::End();
+
+    // Light texel list lengths (appended to the statistic window)
+    if (g_ListStatistics && ((g_ShadowMapsAlgo == 1) || g_CPUCompare)) {
+        ImGui::Begin("Statistic");
+        if (ImGui::CollapsingHeader("Light texel lists", ImGuiTreeNodeFlags_DefaultOpen)) {
+            const GLuint occupied = g_ListLengths.resolution * g_ListLengths.resolution - g_ListLengths.histogram[0];
+            ImGui::Text("samples: %u", g_ListLengths.num_samples);
+            ImGui::Text("occupied texels: %u", occupied);
+            ImGui::Text("max / p99: %u / %u", g_ListLengths.max_length, g_ListLengthP99);
+            ImGui::Text("ray tests: %u", g_RayTestCounters[0]);
+            ImGui::Text("shadowed visits: %u", g_RayTestCounters[1]);
+            ImGui::Text("shadow map stores: %u", g_RayTestCounters[2]);
+
+            // Occupied texels only, the empty ones would flatten the plot
+            const int num_bins = int(glm::min(g_ListLengths.max_length, NUM_LIST_LENGTH_BINS - 1));
+            GLuint max_count = 1;
+            for (int i = 1; i <= num_bins; i++)
+                max_count = glm::max(max_count, g_ListLengths.histogram[i]);
+            ImPlot::SetNextPlotLimits(0.5, num_bins + 0.5, 0.0, 1.05 * max_count, ImGuiCond_Always);
+            if (ImPlot::BeginPlot("##ListLengths", "length", "texels", ImVec2(205, 150), ImPlotFlags_CanvasOnly)) {
+                ImPlot::PlotBars("texels", &g_ListLengths.histogram[1], num_bins, 0.67, 1.0);
+                ImPlot::EndPlot();
+            }
+        }
+        ImGui::End();
+    }
+
     *static_cast<int *>(user) = 485;
 }
 
@@ -113,6 +367,94 @@ void keyboardChanged(int key, int action, int mods) {
 // Desc: 
 //-----------------------------------------------------------------------------
 int main(int argc, char* argv[]) {
+    int headless_frames = 0;
+    int light_positions = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless_frames = 10;
+            if ((i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+                headless_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--alias-free") == 0) {
+            g_ShadowMapsAlgo = 1;
+            g_Switch = true;
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            g_ShadowMapsAlgo = 2;
+            g_Switch = true;
+        } else if (strcmp(argv[i], "--compare") == 0) {
+            g_CPUCompare = true;
+        } else if (strcmp(argv[i], "--gpu-samples") == 0) {
+            g_CPUUseGPUSamples = true;
+        } else if (strcmp(argv[i], "--compacted") == 0) {
+            g_ListMode = CompactedList;
+        } else if (strcmp(argv[i], "--pixel-nodes") == 0) {
+            g_PixelNodeIndex = true;
+        } else if (strcmp(argv[i], "--compact-nodes") == 0) {
+            g_CompactNodes = true;
+        } else if (strcmp(argv[i], "--fused-lists") == 0) {
+            g_FusedListGeneration = true;
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            g_DepthPrepass = true;
+        } else if (strcmp(argv[i], "--overdraw-stats") == 0) {
+            g_OverdrawStatistics = true;
+        } else if (strcmp(argv[i], "--visibility-buffer") == 0) {
+            g_VisibilityEncoding = VisibilityBuffer;
+        } else if (strcmp(argv[i], "--half-positions") == 0) {
+            g_VisibilityEncoding = VisibilityHalf;
+        } else if (strcmp(argv[i], "--depth-samples") == 0) {
+            g_VisibilityEncoding = VisibilityDepth;
+        } else if (strcmp(argv[i], "--encoding-error") == 0) {
+            g_EncodingError = true;
+        } else if (strcmp(argv[i], "--packed-shadows") == 0) {
+            g_PackedShadows = true;
+        } else if ((strcmp(argv[i], "--lights") == 0) && (i + 1 < argc)) {
+            g_NumLights = glm::clamp(atoi(argv[++i]), 1, MAX_LIGHTS);
+        } else if ((strcmp(argv[i], "--light") == 0) && (i + 1 < argc)) {
+            const char* value = argv[++i];
+            glm::vec3 position;
+            if ((light_positions + 1 >= MAX_LIGHTS) || (sscanf(value, "%f,%f,%f", &position.x, &position.y, &position.z) != 3)) {
+                printf("--light %s: expected X,Y,Z of at most %d additional lights\n", value, MAX_LIGHTS - 1);
+                return 1;
+            }
+            g_LightPositions[++light_positions] = position;
+        } else if (strcmp(argv[i], "--point-light") == 0) {
+            g_PointLight = true;
+        } else if ((strcmp(argv[i], "--cascades") == 0) && (i + 1 < argc)) {
+            g_NumCascades = glm::clamp(atoi(argv[++i]), 1, MAX_CASCADES);
+        } else if (strcmp(argv[i], "--generation-tags") == 0) {
+            g_GenerationTags = true;
+        } else if (strcmp(argv[i], "--occupancy-stencil") == 0) {
+            g_OccupancyStencil = true;
+        } else if (strcmp(argv[i], "--depth-tiles") == 0) {
+            g_ReceiverDepthTiles = true;
+        } else if (strcmp(argv[i], "--auto-resolution") == 0) {
+            g_AutoResolution = true;
+        } else if (strcmp(argv[i], "--skip-shadowed") == 0) {
+            g_SkipShadowed = true;
+        } else if (strcmp(argv[i], "--vertex-pulling") == 0) {
+            g_VertexPulling = true;
+        } else if (strcmp(argv[i], "--edge-functions") == 0) {
+            g_EdgeFunctions = true;
+        } else if (strcmp(argv[i], "--load-balancing") == 0) {
+            g_LoadBalancing = true;
+        } else if (strcmp(argv[i], "--list-stats") == 0) {
+            g_ListStatistics = true;
+            if ((i + 1 < argc) && (strncmp(argv[i + 1], "--", 2) != 0))
+                g_ListStatisticsFileName = argv[++i];
+        } else if ((strcmp(argv[i], "--light-fit") == 0) && (i + 1 < argc)) {
+            const char* modes[NumLightFits] = { "fixed", "gpu", "cpu" };
+            for (int mode = 0; mode < NumLightFits; mode++)
+                if (strcmp(argv[i + 1], modes[mode]) == 0) g_LightFit = mode;
+            i++;
+        }
+    }
+
+    // The additional lights without --light are placed around the main light
+    g_NumLights = glm::max(g_NumLights, light_positions + 1);
+    for (int light = light_positions + 1; light < MAX_LIGHTS; light++)
+        g_LightPositions[light] = defaultLightPosition(light);
+    if ((g_NumLights > 1) && (g_PointLight || (g_NumCascades > 0) || (g_ShadowMapsAlgo == 2)))
+        printf("The additional lights need the alias-free GPU algorithm without --point-light and --cascades, only the main light casts shadows\n");
+
     int OGL_CONFIGURATION[] = {
         GLFW_CONTEXT_VERSION_MAJOR,  4,
         GLFW_CONTEXT_VERSION_MINOR,  0,
@@ -120,19 +462,23 @@ int main(int argc, char* argv[]) {
         GLFW_OPENGL_DEBUG_CONTEXT,   GL_TRUE,
         GLFW_OPENGL_PROFILE,         GLFW_OPENGL_COMPAT_PROFILE, // GLFW_OPENGL_CORE_PROFILE
         PGR2_SHOW_MEMORY_STATISTICS, GL_TRUE, 
+        PGR2_HEADLESS_FRAMES,        headless_frames,
         0
     };
 
     printf("%s\n", help_message);
 
-    return common_main(1200, 900, "[PGR2] Alias Free Shadow Maps",
-                       OGL_CONFIGURATION, // OGL configuration hints
-                       initGL,            // Init GL callback function
-                       nullptr,           // Release GL callback function
-                       showGUI,           // Show GUI callback function
-                       display,           // Display callback function
-                       resizeWindow,      // Window resize callback function
-                       keyboardChanged,   // Keyboard callback function
-                       nullptr,           // Mouse button callback function
-                       nullptr);          // Mouse motion callback function
+    const int result = common_main(1200, 900, "[PGR2] Alias Free Shadow Maps",
+                                   OGL_CONFIGURATION, // OGL configuration hints
+                                   initGL,            // Init GL callback function
+                                   releaseGL,         // Release GL callback function
+                                   showGUI,           // Show GUI callback function
+                                   display,           // Display callback function
+                                   resizeWindow,      // Window resize callback function
+                                   keyboardChanged,   // Keyboard callback function
+                                   nullptr,           // Mouse button callback function
+                                   nullptr);          // Mouse motion callback function
+
+    // CPU vs GPU shadow maps differing above the bound (--compare)
+    return ((result == 0) && g_CPUCompareFailed) ? 6 : result;
 }
@@ -0,0 +1,352 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//-----------------------------------------------------------------------------
+#include "alias_free_cpu.h"
+#include "shadow_kernel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace AliasFreeCPU {
+
+    namespace {
+        const int    CAMERA_TILE_SIZE  = 64;      // Tile size of the 1st pass rasterization [pixels]
+        const int    LIGHT_TILE_SIZE   = 32;      // Tile size of the 3rd pass rasterization [light texels]
+        const size_t TRIANGLE_GRAIN    = 1024;    // Triangles per task
+        const size_t ROW_GRAIN         = 16;      // Image rows per task
+        const size_t SCAN_BLOCK        = 65536;   // Items per task of the prefix sum
+        const uint32_t NO_TEXEL        = ~0u;
+
+        typedef std::chrono::high_resolution_clock Clock;
+
+        double elapsedMs(const Clock::time_point& start) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: Engine()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    Engine::Engine(unsigned int num_threads) : pool(num_threads), conservative(true), edge_functions(false), viewport(0), light_resolution(0) {
+        statistics = Statistics();
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: setScene()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void Engine::setScene(const std::vector<glm::vec3>& triangles) {
+        scene.resize(triangles.size() - triangles.size() % 3);
+        for (size_t i = 0; i < scene.size(); i++)
+            scene[i] = glm::vec4(triangles[i], 1.0f);
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: render()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void Engine::render(const glm::mat4& camera_view, const glm::mat4& camera_projection, const glm::ivec2& viewport_size,
+                        const glm::mat4& light_view, const glm::mat4& light_projection, int resolution) {
+        generateVisibilityMap(camera_view, camera_projection, viewport_size, light_view);
+        buildLists(light_projection, resolution);
+        shadowTest(light_view, light_projection);
+        resolveShadows();
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: setupTriangles()
+    // Desc: Transforms, clips and sets up all scene triangles for rasterization, primitive order is kept
+    //-----------------------------------------------------------------------------
+    void Engine::setupTriangles(const glm::mat4& view, const glm::mat4& projection, const glm::mat4& attribute_matrix,
+                                const glm::ivec2& target_size, bool cull_back_faces, bool raster_conservative) {
+        const size_t num_triangles = scene.size() / 3;
+        const size_t num_chunks    = (num_triangles + TRIANGLE_GRAIN - 1) / TRIANGLE_GRAIN;
+        std::vector<std::vector<RasterTriangle> > chunks(num_chunks);
+
+        pool.parallelFor(num_triangles, TRIANGLE_GRAIN, [&](size_t begin, size_t end) {
+            std::vector<RasterTriangle>& out = chunks[begin / TRIANGLE_GRAIN];
+            out.reserve(end - begin);
+            ClipVertex vertices[3];
+            for (size_t t = begin; t < end; t++) {
+                for (int k = 0; k < 3; k++) {
+                    const glm::vec4& vertex = scene[3 * t + k];
+                    vertices[k].position  = projection * (view * vertex);
+                    vertices[k].attribute = glm::vec3(attribute_matrix * vertex);
+                }
+                SetupTriangle(vertices, static_cast<uint32_t>(t), target_size, cull_back_faces, raster_conservative, out);
+            }
+        });
+
+        std::vector<size_t> offsets(num_chunks + 1, 0);
+        for (size_t i = 0; i < num_chunks; i++)
+            offsets[i + 1] = offsets[i] + chunks[i].size();
+        raster_triangles.resize(offsets[num_chunks]);
+        pool.parallelFor(num_chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                std::copy(chunks[i].begin(), chunks[i].end(), raster_triangles.begin() + offsets[i]);
+        });
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: generateVisibilityMap()
+    // Desc: 1st_pass_visibility_map_generation.* with depth test GL_LESS and back face culling
+    //-----------------------------------------------------------------------------
+    void Engine::generateVisibilityMap(const glm::mat4& camera_view, const glm::mat4& camera_projection,
+                                       const glm::ivec2& viewport_size, const glm::mat4& light_view) {
+        const Clock::time_point start = Clock::now();
+
+        viewport = viewport_size;
+        const size_t num_pixels = static_cast<size_t>(viewport.x) * viewport.y;
+        visibility_map.resize(num_pixels);
+        depth_buffer.resize(num_pixels);
+        pool.parallelFor(viewport.y, ROW_GRAIN, [&](size_t begin, size_t end) {
+            std::fill(visibility_map.begin() + begin * viewport.x, visibility_map.begin() + end * viewport.x, glm::vec4(0.0f));
+            std::fill(depth_buffer.begin() + begin * viewport.x, depth_buffer.begin() + end * viewport.x, 1.0f);
+        });
+
+        setupTriangles(camera_view, camera_projection, light_view, viewport, true, false);
+        BinTriangles(pool, raster_triangles, viewport, CAMERA_TILE_SIZE, bins);
+
+        // Every tile is owned by a single task, so the depth test needs no synchronization
+        pool.parallelFor(static_cast<size_t>(bins.tile_count.x) * bins.tile_count.y, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++) {
+                const glm::ivec2 origin = glm::ivec2(static_cast<int>(tile % bins.tile_count.x), static_cast<int>(tile / bins.tile_count.x)) * CAMERA_TILE_SIZE;
+                const glm::ivec4 rect(origin, glm::min(origin + CAMERA_TILE_SIZE, viewport) - 1);
+
+                for (uint32_t i = bins.offsets[tile]; i < bins.offsets[tile + 1]; i++) {
+                    const RasterTriangle& triangle = raster_triangles[bins.triangles[i]];
+                    RasterizeTriangle(triangle, rect, false, [&](int x, int y, const glm::vec3& barycentrics) {
+                        const size_t pixel = static_cast<size_t>(y) * viewport.x + x;
+                        const float  depth = InterpolateDepth(triangle, barycentrics);
+                        if (depth < depth_buffer[pixel]) {
+                            depth_buffer[pixel]   = depth;
+                            visibility_map[pixel] = glm::vec4(InterpolateAttribute(triangle, barycentrics), 1.0f);
+                        }
+                    });
+                }
+            }
+        });
+
+        statistics.time[0] = elapsedMs(start);
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: setVisibilityMap()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void Engine::setVisibilityMap(const std::vector<glm::vec4>& samples, const glm::ivec2& viewport_size) {
+        viewport       = viewport_size;
+        visibility_map = samples;
+        visibility_map.resize(static_cast<size_t>(viewport.x) * viewport.y, glm::vec4(0.0f));
+        statistics.time[0] = 0.0;
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: buildLists()
+    // Desc: 2nd_pass_list_buffer_generation.fs, the lists are built as compressed
+    //       sparse rows (count, prefix sum, scatter) instead of linked lists
+    //-----------------------------------------------------------------------------
+    void Engine::buildLists(const glm::mat4& light_projection, int resolution) {
+        const Clock::time_point start = Clock::now();
+
+        light_resolution = resolution;
+        const size_t num_texels = static_cast<size_t>(resolution) * resolution;
+        const size_t num_pixels = visibility_map.size();
+        if (texel_cursors.size() != num_texels)
+            std::vector<std::atomic<uint32_t> >(num_texels).swap(texel_cursors);
+        pool.parallelFor(num_texels, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                texel_cursors[i].store(0, std::memory_order_relaxed);
+        });
+
+        // Light texel of every sample
+        sample_texel.resize(num_pixels);
+        const float texel_scale = static_cast<float>(resolution);
+        pool.parallelFor(viewport.y, ROW_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t pixel = begin * viewport.x; pixel < end * viewport.x; pixel++) {
+                const glm::vec4& sample = visibility_map[pixel];
+                sample_texel[pixel] = NO_TEXEL;
+
+                if (sample.w != 1.0f)
+                    continue;
+
+                // Discard samples that are outside of the light frustum (behind the light the division flips the sign)
+                const glm::vec4 clip = light_projection * glm::vec4(glm::vec3(sample), 1.0f);
+                if (clip.w <= 0.0f)
+                    continue;
+                const glm::vec2 ndc  = glm::vec2(clip) / clip.w;
+                if ((glm::abs(ndc.x) > 1.0f) || (glm::abs(ndc.y) > 1.0f))
+                    continue;
+
+                // Get view plane coordinates (samples mapped outside of the image are dropped like imageAtomicExchange() does)
+                const glm::vec2 coord = (ndc * 0.5f + 0.5f) * texel_scale;
+                if (!((coord.x >= 0.0f) && (coord.x < texel_scale) && (coord.y >= 0.0f) && (coord.y < texel_scale)))
+                    continue;
+
+                const uint32_t texel = static_cast<uint32_t>(static_cast<int>(coord.y)) * resolution + static_cast<uint32_t>(static_cast<int>(coord.x));
+                sample_texel[pixel] = texel;
+                texel_cursors[texel].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        // Exclusive prefix sum of the list lengths
+        const size_t num_blocks = (num_texels + SCAN_BLOCK - 1) / SCAN_BLOCK;
+        std::vector<uint32_t> block_sums(num_blocks + 1, 0);
+        std::vector<uint32_t> block_occupied(num_blocks, 0);
+        pool.parallelFor(num_texels, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            uint32_t sum = 0, occupied = 0;
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t count = texel_cursors[i].load(std::memory_order_relaxed);
+                sum      += count;
+                occupied += (count > 0) ? 1 : 0;
+            }
+            block_sums[begin / SCAN_BLOCK + 1]   = sum;
+            block_occupied[begin / SCAN_BLOCK]   = occupied;
+        });
+        statistics.occupied_texels = 0;
+        for (size_t i = 0; i < num_blocks; i++) {
+            block_sums[i + 1]          += block_sums[i];
+            statistics.occupied_texels += block_occupied[i];
+        }
+
+        texel_offsets.resize(num_texels + 1);
+        texel_offsets[num_texels] = block_sums[num_blocks];
+        pool.parallelFor(num_texels, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            uint32_t offset = block_sums[begin / SCAN_BLOCK];
+            for (size_t i = begin; i < end; i++) {
+                const uint32_t count = texel_cursors[i].load(std::memory_order_relaxed);
+                texel_offsets[i] = offset;
+                texel_cursors[i].store(offset, std::memory_order_relaxed);
+                offset += count;
+            }
+        });
+
+        // Scatter the samples into the lists
+        const size_t num_samples = texel_offsets[num_texels];
+        statistics.samples = static_cast<uint32_t>(num_samples);
+        sample_x.resize(num_samples);
+        sample_y.resize(num_samples);
+        sample_z.resize(num_samples);
+        sample_pixel.resize(num_samples);
+        sample_shadow.assign(num_samples, 0);
+        pool.parallelFor(viewport.y, ROW_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t pixel = begin * viewport.x; pixel < end * viewport.x; pixel++) {
+                const uint32_t texel = sample_texel[pixel];
+                if (texel == NO_TEXEL)
+                    continue;
+
+                const uint32_t slot = texel_cursors[texel].fetch_add(1, std::memory_order_relaxed);
+                sample_x[slot]     = visibility_map[pixel].x;
+                sample_y[slot]     = visibility_map[pixel].y;
+                sample_z[slot]     = visibility_map[pixel].z;
+                sample_pixel[slot] = static_cast<uint32_t>(pixel);
+            }
+        });
+
+        statistics.time[1] = elapsedMs(start);
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: shadowTest()
+    // Desc: 3rd_pass_shadow_test.*, every occluder is rasterized into the light grid
+    //       and tests the shadow rays of all samples in the covered texels
+    //-----------------------------------------------------------------------------
+    void Engine::shadowTest(const glm::mat4& light_view, const glm::mat4& light_projection) {
+        const Clock::time_point start = Clock::now();
+
+        // Light view space triangles, their planes and edge functions (3rd_pass_triangle_setup.cs)
+        const size_t num_triangles = scene.size() / 3;
+        occluders.resize(num_triangles);
+        pool.parallelFor(num_triangles, TRIANGLE_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                Occluder& occluder = occluders[t];
+                for (int k = 0; k < 3; k++)
+                    occluder.vertices[k] = glm::vec3(light_view * scene[3 * t + k]);
+
+                const glm::vec3& a = occluder.vertices[0];
+                const glm::vec3 normal = glm::normalize(glm::cross(occluder.vertices[1] - a, occluder.vertices[2] - a));
+                occluder.plane = glm::vec4(normal, glm::dot(normal, a));
+                SetupEdgeFunctions(occluder);
+            }
+        });
+
+        const glm::ivec2 grid_size(light_resolution);
+        setupTriangles(light_view, light_projection, light_view, grid_size, false, conservative);
+        BinTriangles(pool, raster_triangles, grid_size, LIGHT_TILE_SIZE, bins);
+
+        // A sample belongs to one texel and a texel to one tile, so shadow flags are written without races
+        std::atomic<uint64_t> ray_tests(0);
+        pool.parallelFor(static_cast<size_t>(bins.tile_count.x) * bins.tile_count.y, 1, [&](size_t begin, size_t end) {
+            uint64_t tests = 0;
+            for (size_t tile = begin; tile < end; tile++) {
+                const glm::ivec2 origin = glm::ivec2(static_cast<int>(tile % bins.tile_count.x), static_cast<int>(tile / bins.tile_count.x)) * LIGHT_TILE_SIZE;
+                const glm::ivec4 rect(origin, glm::min(origin + LIGHT_TILE_SIZE, grid_size) - 1);
+
+                for (uint32_t i = bins.offsets[tile]; i < bins.offsets[tile + 1]; i++) {
+                    const RasterTriangle& triangle = raster_triangles[bins.triangles[i]];
+                    const Occluder&       occluder = occluders[triangle.primitive];
+                    RasterizeTriangle(triangle, rect, conservative, [&](int x, int y, const glm::vec3&) {
+                        const size_t texel = static_cast<size_t>(y) * light_resolution + x;
+                        const uint32_t first = texel_offsets[texel];
+                        const uint32_t count = texel_offsets[texel + 1] - first;
+                        if (edge_functions)
+                            ShadowTestEdgeFunctions(occluder, sample_x.data() + first, sample_y.data() + first, sample_z.data() + first, sample_shadow.data() + first, count);
+                        else
+                            ShadowTest(occluder, sample_x.data() + first, sample_y.data() + first, sample_z.data() + first, sample_shadow.data() + first, count);
+                        tests += count;
+                    });
+                }
+            }
+            ray_tests += tests;
+        });
+        statistics.ray_tests = ray_tests.load();
+
+        statistics.time[2] = elapsedMs(start);
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: resolveShadows()
+    // Desc: Shadow flags back in the visibility map layout and the shadow factor of 4th_pass_render_scene.fs
+    //-----------------------------------------------------------------------------
+    void Engine::resolveShadows() {
+        const Clock::time_point start = Clock::now();
+
+        const size_t num_pixels  = visibility_map.size();
+        const size_t num_samples = sample_pixel.size();
+        shadow_map.resize(num_pixels);
+        shadow_mask.resize(num_pixels);
+        pool.parallelFor(num_pixels, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            std::fill(shadow_map.begin() + begin, shadow_map.begin() + end, 0u);
+        });
+
+        std::atomic<uint32_t> shadowed(0);
+        pool.parallelFor(num_samples, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            uint32_t count = 0;
+            for (size_t s = begin; s < end; s++) {
+                shadow_map[sample_pixel[s]] = sample_shadow[s];
+                count += sample_shadow[s];
+            }
+            shadowed += count;
+        });
+        statistics.shadowed_samples = shadowed.load();
+
+        pool.parallelFor(num_pixels, SCAN_BLOCK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                shadow_mask[i] = (shadow_map[i] > 0) ? 0.2f : 1.0f;
+        });
+
+        statistics.time[3] = elapsedMs(start);
+    }
+
+} // end of namespace AliasFreeCPU
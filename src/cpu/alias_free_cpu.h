@@ -0,0 +1,189 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Runs the four alias-free passes (visibility map, light texel lists, shadow
+//  test, shadow resolve) on the CPU without OpenGL
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "rasterizer.h"
+#include "thread_pool.h"
+
+namespace AliasFreeCPU {
+
+    const float SHADOW_ACNE_EPSILON = 0.0001f;  // Same value as in 3rd_pass_shadow_test.fs
+
+    // Occluding triangle in light view space with its plane (3rd_pass_shadow_test.gs)
+    struct Occluder {
+        glm::vec3 vertices[3];
+        glm::vec4 plane;        // plane.xyz := n (plane normal), plane.w := d (dot(n,p) for a given point p on the plane)
+        glm::vec4 edges[3];     // Edge planes through the light (SetupEdgeFunctions()), w := n / d
+    };
+
+    struct Statistics {
+        double   time[4];           // Duration of the passes [ms]
+        uint32_t samples;           // Visibility samples inserted into the light texel lists
+        uint32_t occupied_texels;   // Light texels with a non-empty list
+        uint32_t shadowed_samples;  // Samples found in shadow
+        uint64_t ray_tests;         // Executed ray/triangle tests
+    };
+
+    //-----------------------------------------------------------------------------
+    // Name: PointInsideTriangle()
+    // Desc: Test if point p lies inside the ccw triangle (pointInsideTriangle() in 3rd_pass_shadow_test.fs)
+    //-----------------------------------------------------------------------------
+    inline bool PointInsideTriangle(const Occluder& occluder, const glm::vec3& p) {
+        // Translate point and triangle so that point lies at origin
+        const glm::vec3 a = occluder.vertices[0] - p;
+        const glm::vec3 b = occluder.vertices[1] - p;
+        const glm::vec3 c = occluder.vertices[2] - p;
+        const float ab = glm::dot(a, b);
+        const float ac = glm::dot(a, c);
+        const float bc = glm::dot(b, c);
+        const float cc = glm::dot(c, c);
+
+        // Make sure plane normals for triangles pab and pbc point in the same direction
+        if (bc * ac - cc * ab < 0.0f) return false;
+
+        // Make sure plane normals for triangles pab and pca point in the same direction
+        const float bb = glm::dot(b, b);
+        if (ab * bc - ac * bb < 0.0f) return false;
+
+        // Otherwise p must be in or on the triangle
+        return true;
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: IntersectRayTriangle()
+    // Desc: Test if shadow ray starting from the point a in the direction v intersects triangle
+    //       (intersectRayTriangle() in 3rd_pass_shadow_test.fs)
+    //-----------------------------------------------------------------------------
+    inline bool IntersectRayTriangle(const Occluder& occluder, const glm::vec3& a, const glm::vec3& v) {
+        // Intersect plane
+        const glm::vec3 n = glm::vec3(occluder.plane);
+        const float     t = (occluder.plane.w - glm::dot(n, a)) / glm::dot(n, v);
+
+        if (0.0f <= t) {
+            // Plane was intersected, check if the intersection lies inside the triangle
+            return PointInsideTriangle(occluder, a + t * v);
+        }
+
+        return false;
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: SetupEdgeFunctions()
+    // Desc: Edge planes through the light (origin) oriented to the inside of the triangle and the plane
+    //       scaled to dot(q, x) == 1 (setupEdgeFunctions() in 3rd_pass_triangle_setup.cs)
+    //-----------------------------------------------------------------------------
+    inline void SetupEdgeFunctions(Occluder& occluder) {
+        const glm::vec3& v0 = occluder.vertices[0];
+        const glm::vec3& v1 = occluder.vertices[1];
+        const glm::vec3& v2 = occluder.vertices[2];
+        const float     s = (glm::dot(v0, glm::cross(v1, v2)) < 0.0f) ? -1.0f : 1.0f;
+        const glm::vec3 q = (occluder.plane.w != 0.0f) ? glm::vec3(occluder.plane) / occluder.plane.w : glm::vec3(0.0f);
+        occluder.edges[0] = glm::vec4(s * glm::cross(v0, v1), q.x);
+        occluder.edges[1] = glm::vec4(s * glm::cross(v1, v2), q.y);
+        occluder.edges[2] = glm::vec4(s * glm::cross(v2, v0), q.z);
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: EdgeFunctionsOccluded()
+    // Desc: Same result as IntersectRayTriangle() for the shadow ray of the sample p in front of the light
+    //       (edgeFunctionsOccluded() in 3rd_pass_shadow_test.fs)
+    //-----------------------------------------------------------------------------
+    inline bool EdgeFunctionsOccluded(const Occluder& occluder, const glm::vec3& p) {
+        // Light ray through the triangle
+        if (glm::dot(glm::vec3(occluder.edges[0]), p) < 0.0f) return false;
+        if (glm::dot(glm::vec3(occluder.edges[1]), p) < 0.0f) return false;
+        if (glm::dot(glm::vec3(occluder.edges[2]), p) < 0.0f) return false;
+
+        // The ray hits the plane at p / w, between the light and the ray origin offset by SHADOW_ACNE_EPSILON
+        const float w = glm::dot(glm::vec3(occluder.edges[0].w, occluder.edges[1].w, occluder.edges[2].w), p);
+        return w * (1.0f - SHADOW_ACNE_EPSILON * (1.0f / std::sqrt(glm::dot(p, p)))) >= 1.0f;
+    }
+
+    class Engine {
+    public:
+        // num_threads == 0 ... one thread per hardware thread
+        explicit Engine(unsigned int num_threads = 0);
+
+        // Scene geometry, 3 object space vertices per triangle
+        void setScene(const std::vector<glm::vec3>& triangles);
+
+        // Light grid rasterization in the shadow test, true ~ GL_CONSERVATIVE_RASTERIZATION_NV
+        void setConservative(bool enable) {
+            conservative = enable;
+        }
+
+        // Shadow test by the precomputed edge functions instead of the plane intersection (u_EdgeFunctions)
+        void setEdgeFunctions(bool enable) {
+            edge_functions = enable;
+        }
+
+        // Runs all passes
+        void render(const glm::mat4& camera_view, const glm::mat4& camera_projection, const glm::ivec2& viewport,
+                    const glm::mat4& light_view, const glm::mat4& light_projection, int light_resolution);
+
+        // 1st pass: light view space position of the closest surface in every pixel, w == 1 marks a sample
+        void generateVisibilityMap(const glm::mat4& camera_view, const glm::mat4& camera_projection,
+                                   const glm::ivec2& viewport, const glm::mat4& light_view);
+        // Replaces the 1st pass result, e.g. by the visibility map read back from the GPU
+        void setVisibilityMap(const std::vector<glm::vec4>& samples, const glm::ivec2& viewport);
+        // 2nd pass: samples sorted into lists of the light texels
+        void buildLists(const glm::mat4& light_projection, int light_resolution);
+        // 3rd pass: shadow rays of the samples tested against the occluders covering their texels
+        void shadowTest(const glm::mat4& light_view, const glm::mat4& light_projection);
+        // 4th pass: per pixel shadow map and shadow mask
+        void resolveShadows();
+
+        const std::vector<glm::vec4>& getVisibilityMap() const { return visibility_map; }
+        const std::vector<uint32_t>&  getShadowMap() const     { return shadow_map; }     // 1 ~ in shadow, same as the ShadowMap texture
+        const std::vector<float>&     getShadowMask() const    { return shadow_mask; }    // Light modulation, max(0.2, shadow)
+        const glm::ivec2&             getViewport() const      { return viewport; }
+        const Statistics&             getStatistics() const    { return statistics; }
+        unsigned int                  getThreadCount() const   { return pool.size(); }
+
+    private:
+        void setupTriangles(const glm::mat4& view, const glm::mat4& projection, const glm::mat4& attribute_matrix,
+                            const glm::ivec2& target_size, bool cull_back_faces, bool raster_conservative);
+
+        ThreadPool                  pool;
+        bool                        conservative;
+        bool                        edge_functions;
+        Statistics                  statistics;
+
+        std::vector<glm::vec4>      scene;              // Object space vertices (w = 1)
+        std::vector<RasterTriangle> raster_triangles;
+        TileBins                    bins;
+
+        // 1st pass
+        glm::ivec2                  viewport;
+        std::vector<glm::vec4>      visibility_map;
+        std::vector<float>          depth_buffer;
+
+        // 2nd pass, lists are stored as compressed sparse rows
+        int                         light_resolution;
+        std::vector<uint32_t>       texel_offsets;      // light_resolution^2 + 1 items
+        std::vector<std::atomic<uint32_t> > texel_cursors; // List lengths, then insertion positions
+        std::vector<uint32_t>       sample_texel;       // Light texel of every pixel (~0u ... no sample)
+        std::vector<float>          sample_x;           // Sample positions in the list order (SoA)
+        std::vector<float>          sample_y;
+        std::vector<float>          sample_z;
+        std::vector<uint32_t>       sample_pixel;       // Visibility map pixel of the sample
+        std::vector<uint8_t>        sample_shadow;
+
+        // 3rd pass
+        std::vector<Occluder>       occluders;
+
+        // 4th pass
+        std::vector<uint32_t>       shadow_map;
+        std::vector<float>          shadow_mask;
+    };
+
+} // end of namespace AliasFreeCPU
@@ -0,0 +1,178 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Microbenchmark of the batched shadow ray / triangle kernel
+//
+//  Usage: shadow_kernel_bench [samples] [occluders]
+//  Every compiled kernel variant tests all occluders against light texel lists
+//  of different lengths, the cost per ray/triangle test is printed and the
+//  shadow flags are compared with the scalar variant of the same formulation.
+//  The edge function formulation is compared with the plane intersection on
+//  the same random triangles. The plane intersection also reports hits of the
+//  plane behind the light (rounding of the inside test far from the triangle),
+//  apart from these only samples on the triangle boundary may differ.
+//-----------------------------------------------------------------------------
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "../shadow_kernel.h"
+
+using namespace AliasFreeCPU;
+
+namespace {
+    typedef void (*KernelFunc)(const Occluder&, const float*, const float*, const float*, uint8_t*, size_t);
+
+    struct Variant {
+        const char* name;
+        KernelFunc  func;
+        size_t      reference;  // Variant the shadow flags are compared with
+    };
+
+    //-----------------------------------------------------------------------------
+    // Name: makeOccluder()
+    // Desc: Triangle between the light (origin) and the samples, random orientation
+    //-----------------------------------------------------------------------------
+    Occluder makeOccluder(std::mt19937& rng) {
+        std::uniform_real_distribution<float> center(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> offset(-0.6f, 0.6f);
+        std::uniform_real_distribution<float> depth(-4.0f, -2.0f);
+
+        Occluder occluder;
+        const glm::vec3 c(center(rng), center(rng), depth(rng));
+        for (int k = 0; k < 3; k++)
+            occluder.vertices[k] = c + glm::vec3(offset(rng), offset(rng), 0.5f * offset(rng));
+
+        const glm::vec3& a = occluder.vertices[0];
+        const glm::vec3 normal = glm::normalize(glm::cross(occluder.vertices[1] - a, occluder.vertices[2] - a));
+        occluder.plane = glm::vec4(normal, glm::dot(normal, a));
+        SetupEdgeFunctions(occluder);
+        return occluder;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const size_t num_samples   = (argc > 1) ? static_cast<size_t>(atoi(argv[1])) : 65536;
+    const size_t num_occluders = (argc > 2) ? static_cast<size_t>(atoi(argv[2])) : 256;
+    if ((num_samples == 0) || (num_occluders == 0)) {
+        printf("Usage: %s [samples] [occluders]\n", argv[0]);
+        return 1;
+    }
+
+    // Samples behind the occluders (the light looks down -z in light view space)
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> lateral(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> depth(-8.0f, -1.0f);
+    std::vector<float> x(num_samples), y(num_samples), z(num_samples);
+    for (size_t i = 0; i < num_samples; i++) {
+        x[i] = lateral(rng);
+        y[i] = lateral(rng);
+        z[i] = depth(rng);
+    }
+    std::vector<Occluder> occluders(num_occluders);
+    for (size_t i = 0; i < num_occluders; i++)
+        occluders[i] = makeOccluder(rng);
+
+    std::vector<Variant> variants;
+    Variant scalar = { "scalar", ShadowTestScalar, 0 };
+    variants.push_back(scalar);
+#ifdef ALIASFREE_SHADOW_KERNEL_SSE
+    Variant sse = { "SSE", ShadowTestSSE, 0 };
+    variants.push_back(sse);
+#endif
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX2
+    Variant avx2 = { "AVX2", ShadowTestAVX2, 0 };
+    variants.push_back(avx2);
+#endif
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX512
+    Variant avx512 = { "AVX-512", ShadowTestAVX512, 0 };
+    variants.push_back(avx512);
+#endif
+    const size_t edge_scalar_index = variants.size();
+    Variant edge_scalar = { "edge", ShadowTestEdgeFunctionsScalar, edge_scalar_index };
+    variants.push_back(edge_scalar);
+#ifdef ALIASFREE_SHADOW_KERNEL_SSE
+    Variant edge_sse = { "edge SSE", ShadowTestEdgeFunctionsSSE, edge_scalar_index };
+    variants.push_back(edge_sse);
+#endif
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX2
+    Variant edge_avx2 = { "edge AVX2", ShadowTestEdgeFunctionsAVX2, edge_scalar_index };
+    variants.push_back(edge_avx2);
+#endif
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX512
+    Variant edge_avx512 = { "edge AVX-512", ShadowTestEdgeFunctionsAVX512, edge_scalar_index };
+    variants.push_back(edge_avx512);
+#endif
+
+    // Typical list lengths are short (a few samples per light texel), long lists show the peak throughput
+    const size_t list_lengths[] = { 1, 3, 8, 16, 64, 1024, num_samples };
+    const size_t num_lengths    = sizeof(list_lengths) / sizeof(list_lengths[0]);
+
+    printf("%zu samples, %zu occluders, ShadowTest() width %d\n\n", num_samples, num_occluders, ShadowTestWidth());
+    printf("%-8s", "list");
+    for (size_t v = 0; v < variants.size(); v++)
+        printf("%12s", variants[v].name);
+    printf("   [ns per ray/triangle test]\n");
+
+    size_t mismatches = 0, formulation_mismatches = 0, behind_light = 0;
+    std::vector<std::vector<uint8_t> > results(variants.size(), std::vector<uint8_t>(num_samples));
+    for (size_t l = 0; l < num_lengths; l++) {
+        const size_t length = glm::min(list_lengths[l], num_samples);
+        printf("%-8zu", length);
+
+        for (size_t v = 0; v < variants.size(); v++) {
+            std::vector<uint8_t>& result = results[v];
+            std::fill(result.begin(), result.end(), 0);
+
+            const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            for (size_t o = 0; o < num_occluders; o++)
+                for (size_t first = 0; first < num_samples; first += length) {
+                    const size_t count = glm::min(length, num_samples - first);
+                    variants[v].func(occluders[o], &x[first], &y[first], &z[first], &result[first], count);
+                }
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+            printf("%12.3f", ns / (static_cast<double>(num_samples) * num_occluders));
+
+            const std::vector<uint8_t>& reference = results[variants[v].reference];
+            if (v != variants[v].reference)
+                for (size_t i = 0; i < num_samples; i++)
+                    mismatches += (result[i] != reference[i]) ? 1 : 0;
+        }
+        printf("\n");
+
+        // Only the last list length is needed, all lengths give the same flags
+        if (l + 1 < num_lengths)
+            continue;
+        for (size_t i = 0; i < num_samples; i++) {
+            if (results[edge_scalar_index][i] == results[0][i])
+                continue;
+
+            // Hit of the plane intersection for all occluders with the plane in front of the light along the ray
+            const glm::vec3 p(x[i], y[i], z[i]);
+            bool in_front = false;
+            for (size_t o = 0; o < num_occluders; o++) {
+                const float w = glm::dot(glm::vec3(occluders[o].edges[0].w, occluders[o].edges[1].w, occluders[o].edges[2].w), p);
+                uint8_t hit = 0;
+                ShadowTestScalar(occluders[o], &x[i], &y[i], &z[i], &hit, 1);
+                in_front = in_front || (hit && (w > 0.0f));
+            }
+            if (results[0][i] && !in_front)
+                behind_light++;
+            else
+                formulation_mismatches++;
+        }
+    }
+
+    size_t shadowed = 0;
+    for (size_t i = 0; i < num_samples; i++)
+        shadowed += results[0][i];
+    printf("\n%zu of %zu samples in shadow, %zu mismatches against the scalar variants\n", shadowed, num_samples, mismatches);
+
+    // Boundary samples only, a few per million shadow flags
+    const double formulation_rate = static_cast<double>(formulation_mismatches) / num_samples;
+    printf("%zu edge function / plane intersection mismatches (%.2e of the samples), %zu plane hits behind the light\n",
+           formulation_mismatches, formulation_rate, behind_light);
+
+    return ((mismatches == 0) && (formulation_rate < 1e-4)) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Tile-binned triangle rasterizer following the OpenGL rasterization rules
+//-----------------------------------------------------------------------------
+#include "rasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace AliasFreeCPU {
+
+    namespace {
+        const int MAX_CLIPPED_VERTICES = 9;   // 3 vertices + 1 per clip plane
+
+        //-----------------------------------------------------------------------------
+        // Name: planeDistance()
+        // Desc: Signed distance to the clip plane, >= 0 inside
+        //-----------------------------------------------------------------------------
+        float planeDistance(const glm::vec4& p, int plane) {
+            switch (plane) {
+            case 0:  return p.w + p.z;                 // near
+            case 1:  return p.w - p.z;                 // far
+            case 2:  return GUARD_BAND * p.w + p.x;
+            case 3:  return GUARD_BAND * p.w - p.x;
+            case 4:  return GUARD_BAND * p.w + p.y;
+            default: return GUARD_BAND * p.w - p.y;
+            }
+        }
+
+        //-----------------------------------------------------------------------------
+        // Name: clipPolygon()
+        // Desc: Sutherland-Hodgman clipping in homogeneous coordinates, returns the number of output vertices
+        //-----------------------------------------------------------------------------
+        int clipPolygon(const ClipVertex* in, int count, int plane, ClipVertex* out) {
+            int out_count = 0;
+            for (int i = 0; i < count; i++) {
+                const ClipVertex& a = in[i];
+                const ClipVertex& b = in[(i + 1) % count];
+                const float da = planeDistance(a.position, plane);
+                const float db = planeDistance(b.position, plane);
+
+                if (da >= 0.0f)
+                    out[out_count++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f)) {
+                    const float t = da / (da - db);
+                    ClipVertex& v = out[out_count++];
+                    v.position  = glm::mix(a.position, b.position, t);
+                    v.attribute = glm::mix(a.attribute, b.attribute, t);
+                }
+            }
+            return out_count;
+        }
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: SetupTriangle()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void SetupTriangle(const ClipVertex vertices[3], uint32_t primitive, const glm::ivec2& viewport,
+                       bool cull_back_faces, bool conservative, std::vector<RasterTriangle>& out) {
+        ClipVertex polygon[2][MAX_CLIPPED_VERTICES];
+        int        count   = 3;
+        int        current = 0;
+        polygon[0][0] = vertices[0];
+        polygon[0][1] = vertices[1];
+        polygon[0][2] = vertices[2];
+
+        // Clip only against planes that are actually crossed (most triangles are completely inside)
+        for (int plane = 0; plane < 6; plane++) {
+            const float d0 = planeDistance(vertices[0].position, plane);
+            const float d1 = planeDistance(vertices[1].position, plane);
+            const float d2 = planeDistance(vertices[2].position, plane);
+            if ((d0 < 0.0f) && (d1 < 0.0f) && (d2 < 0.0f))
+                return;
+            if ((d0 < 0.0f) || (d1 < 0.0f) || (d2 < 0.0f)) {
+                count   = clipPolygon(polygon[current], count, plane, polygon[1 - current]);
+                current = 1 - current;
+                if (count < 3)
+                    return;
+            }
+        }
+
+        // Perspective division and viewport transformation
+        int64_t window_x[MAX_CLIPPED_VERTICES], window_y[MAX_CLIPPED_VERTICES];
+        float   window_z[MAX_CLIPPED_VERTICES], inv_w[MAX_CLIPPED_VERTICES];
+        for (int i = 0; i < count; i++) {
+            const glm::vec4& p = polygon[current][i].position;
+            inv_w[i] = 1.0f / p.w;
+            const glm::vec3 ndc = glm::vec3(p) * inv_w[i];
+            window_x[i] = static_cast<int64_t>(std::floor((ndc.x * 0.5f + 0.5f) * viewport.x * SUBPIXEL_SCALE + 0.5f));
+            window_y[i] = static_cast<int64_t>(std::floor((ndc.y * 0.5f + 0.5f) * viewport.y * SUBPIXEL_SCALE + 0.5f));
+            window_z[i] = ndc.z * 0.5f + 0.5f;
+        }
+
+        // Triangle fan
+        for (int i = 1; i + 1 < count; i++) {
+            int index[3] = { 0, i, i + 1 };
+
+            RasterTriangle triangle;
+            triangle.area = (window_x[index[1]] - window_x[index[0]]) * (window_y[index[2]] - window_y[index[0]]) -
+                            (window_y[index[1]] - window_y[index[0]]) * (window_x[index[2]] - window_x[index[0]]);
+            if (triangle.area == 0)
+                continue;
+            if (triangle.area < 0) {
+                // Clockwise triangle in window space ~ back face (GL_CCW front faces)
+                if (cull_back_faces)
+                    continue;
+                std::swap(index[1], index[2]);
+                triangle.area = -triangle.area;
+            }
+
+            int64_t min_x = window_x[index[0]], max_x = min_x;
+            int64_t min_y = window_y[index[0]], max_y = min_y;
+            for (int k = 0; k < 3; k++) {
+                const int v = index[k];
+                triangle.x[k]         = window_x[v];
+                triangle.y[k]         = window_y[v];
+                triangle.z[k]         = window_z[v];
+                triangle.inv_w[k]     = inv_w[v];
+                triangle.attribute[k] = polygon[current][v].attribute * inv_w[v];
+                min_x = std::min(min_x, window_x[v]);
+                max_x = std::max(max_x, window_x[v]);
+                min_y = std::min(min_y, window_y[v]);
+                max_y = std::max(max_y, window_y[v]);
+            }
+
+            // Pixels overlapped by the bounding box, standard rasterization only needs pixels with a center inside
+            const int64_t half_pixel = conservative ? 0 : SUBPIXEL_SCALE / 2;
+            triangle.bounds = glm::ivec4(static_cast<int>(std::max<int64_t>((min_x - half_pixel) >> SUBPIXEL_BITS, 0)),
+                                         static_cast<int>(std::max<int64_t>((min_y - half_pixel) >> SUBPIXEL_BITS, 0)),
+                                         static_cast<int>(std::min<int64_t>((max_x - half_pixel) >> SUBPIXEL_BITS, viewport.x - 1)),
+                                         static_cast<int>(std::min<int64_t>((max_y - half_pixel) >> SUBPIXEL_BITS, viewport.y - 1)));
+            if ((triangle.bounds.x > triangle.bounds.z) || (triangle.bounds.y > triangle.bounds.w))
+                continue;
+
+            triangle.primitive = primitive;
+            out.push_back(triangle);
+        }
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: BinTriangles()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void BinTriangles(ThreadPool& pool, const std::vector<RasterTriangle>& triangles, const glm::ivec2& viewport,
+                      int tile_size, TileBins& bins) {
+        bins.tile_size  = tile_size;
+        bins.tile_count = (viewport + glm::ivec2(tile_size - 1)) / tile_size;
+        const size_t num_tiles = static_cast<size_t>(bins.tile_count.x) * bins.tile_count.y;
+
+        // Count triangles per tile
+        std::vector<std::atomic<uint32_t> > counts(num_tiles);
+        for (size_t i = 0; i < num_tiles; i++)
+            counts[i].store(0, std::memory_order_relaxed);
+
+        const size_t grain = 1024;
+        pool.parallelFor(triangles.size(), grain, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                const glm::ivec4 tiles = triangles[t].bounds / tile_size;
+                for (int y = tiles.y; y <= tiles.w; y++)
+                    for (int x = tiles.x; x <= tiles.z; x++)
+                        counts[y * bins.tile_count.x + x].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        bins.offsets.resize(num_tiles + 1);
+        bins.offsets[0] = 0;
+        for (size_t i = 0; i < num_tiles; i++) {
+            bins.offsets[i + 1] = bins.offsets[i] + counts[i].load(std::memory_order_relaxed);
+            counts[i].store(bins.offsets[i], std::memory_order_relaxed);
+        }
+
+        // Scatter triangle indices, the order inside a tile depends on the scheduling
+        bins.triangles.resize(bins.offsets[num_tiles]);
+        pool.parallelFor(triangles.size(), grain, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                const glm::ivec4 tiles = triangles[t].bounds / tile_size;
+                for (int y = tiles.y; y <= tiles.w; y++)
+                    for (int x = tiles.x; x <= tiles.z; x++)
+                        bins.triangles[counts[y * bins.tile_count.x + x].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(t);
+            }
+        });
+
+        // ... so restore the primitive order (needed for equal depths in the depth test)
+        pool.parallelFor(num_tiles, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                std::sort(bins.triangles.begin() + bins.offsets[i], bins.triangles.begin() + bins.offsets[i + 1]);
+        });
+    }
+
+} // end of namespace AliasFreeCPU
@@ -0,0 +1,129 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Tile-binned triangle rasterizer following the OpenGL rasterization rules
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+namespace AliasFreeCPU {
+
+    const int     SUBPIXEL_BITS   = 8;                      // Vertex snapping precision, 1/256 pixel like current GPUs
+    const int64_t SUBPIXEL_SCALE  = int64_t(1) << SUBPIXEL_BITS;
+    const float   GUARD_BAND      = 16.0f;                  // Triangles are clipped to 16x the viewport instead of the viewport
+
+    // Clip-space vertex with one perspective-correct attribute
+    struct ClipVertex {
+        glm::vec4 position;
+        glm::vec3 attribute;
+    };
+
+    // Triangle in window coordinates ready to be rasterized
+    struct RasterTriangle {
+        int64_t    x[3];          // Window x in 1/256 pixel
+        int64_t    y[3];          // Window y in 1/256 pixel
+        int64_t    area;          // Twice the area in (1/256 pixel)^2, always positive (vertices are reordered to ccw)
+        float      z[3];          // Window depth
+        float      inv_w[3];      // 1/w of the vertices
+        glm::vec3  attribute[3];  // Attributes divided by w
+        glm::ivec4 bounds;        // Pixels touched by the triangle (min x, min y, max x, max y), inclusive
+        uint32_t   primitive;     // Index of the source triangle
+    };
+
+    // Triangles binned into square screen tiles (compressed sparse rows, primitive order kept inside a tile)
+    struct TileBins {
+        int                   tile_size;
+        glm::ivec2            tile_count;
+        std::vector<uint32_t> offsets;    // tile_count.x * tile_count.y + 1 items
+        std::vector<uint32_t> triangles;  // Indices into the triangle array
+    };
+
+    // Clips the triangle to the near, far and guard-band planes and appends the resulting triangles (0 ... 7) to out
+    void SetupTriangle(const ClipVertex vertices[3], uint32_t primitive, const glm::ivec2& viewport,
+                       bool cull_back_faces, bool conservative, std::vector<RasterTriangle>& out);
+
+    // Sorts triangles into tiles of tile_size x tile_size pixels
+    void BinTriangles(ThreadPool& pool, const std::vector<RasterTriangle>& triangles, const glm::ivec2& viewport,
+                      int tile_size, TileBins& bins);
+
+    //-----------------------------------------------------------------------------
+    // Name: RasterizeTriangle()
+    // Desc: Calls fragment(x, y, barycentrics) for every pixel of rect covered by the triangle.
+    //       Pixel centers and the top-left rule are used by default, with conservative == true
+    //       every pixel overlapped by the triangle is visited (NV_conservative_raster).
+    //-----------------------------------------------------------------------------
+    template <typename FragmentFunc>
+    void RasterizeTriangle(const RasterTriangle& triangle, const glm::ivec4& rect, bool conservative, FragmentFunc fragment) {
+        const int x0 = glm::max(rect.x, triangle.bounds.x);
+        const int y0 = glm::max(rect.y, triangle.bounds.y);
+        const int x1 = glm::min(rect.z, triangle.bounds.z);
+        const int y1 = glm::min(rect.w, triangle.bounds.w);
+        if ((x0 > x1) || (y0 > y1))
+            return;
+
+        // Edge i goes from vertex i to vertex i + 1, its function is positive inside of the ccw triangle
+        int64_t edge_dx[3], edge_dy[3], edge_row[3], edge_bias[3];
+        const int64_t half_pixel = SUBPIXEL_SCALE / 2;
+        const int64_t start_x    = x0 * SUBPIXEL_SCALE + half_pixel;
+        const int64_t start_y    = y0 * SUBPIXEL_SCALE + half_pixel;
+        for (int i = 0; i < 3; i++) {
+            const int j = (i + 1) % 3;
+            edge_dx[i]  = triangle.x[j] - triangle.x[i];
+            edge_dy[i]  = triangle.y[j] - triangle.y[i];
+            edge_row[i] = edge_dx[i] * (start_y - triangle.y[i]) - edge_dy[i] * (start_x - triangle.x[i]);
+
+            if (conservative) {
+                // Maximum of the edge function over the pixel square
+                edge_bias[i] = half_pixel * (glm::abs(edge_dx[i]) + glm::abs(edge_dy[i]));
+            } else {
+                // Top-left rule: samples exactly on the edge belong to left (going down) and top (going left) edges
+                const bool top_left = (edge_dy[i] < 0) || ((edge_dy[i] == 0) && (edge_dx[i] < 0));
+                edge_bias[i] = top_left ? 0 : -1;
+            }
+        }
+
+        const float inv_area = 1.0f / static_cast<float>(triangle.area);
+        for (int y = y0; y <= y1; y++) {
+            int64_t e0 = edge_row[0];
+            int64_t e1 = edge_row[1];
+            int64_t e2 = edge_row[2];
+            for (int x = x0; x <= x1; x++) {
+                if ((e0 + edge_bias[0] >= 0) && (e1 + edge_bias[1] >= 0) && (e2 + edge_bias[2] >= 0)) {
+                    // Barycentric coordinate of a vertex is the edge function of the opposite edge
+                    const glm::vec3 barycentrics(static_cast<float>(e1) * inv_area,
+                                                 static_cast<float>(e2) * inv_area,
+                                                 static_cast<float>(e0) * inv_area);
+                    fragment(x, y, barycentrics);
+                }
+                e0 -= edge_dy[0] * SUBPIXEL_SCALE;
+                e1 -= edge_dy[1] * SUBPIXEL_SCALE;
+                e2 -= edge_dy[2] * SUBPIXEL_SCALE;
+            }
+            for (int i = 0; i < 3; i++)
+                edge_row[i] += edge_dx[i] * SUBPIXEL_SCALE;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: InterpolateDepth()
+    // Desc: Window depth is interpolated linearly in screen space
+    //-----------------------------------------------------------------------------
+    inline float InterpolateDepth(const RasterTriangle& triangle, const glm::vec3& barycentrics) {
+        return barycentrics.x * triangle.z[0] + barycentrics.y * triangle.z[1] + barycentrics.z * triangle.z[2];
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: InterpolateAttribute()
+    // Desc: Perspective-correct interpolation (GLSL "smooth" qualifier)
+    //-----------------------------------------------------------------------------
+    inline glm::vec3 InterpolateAttribute(const RasterTriangle& triangle, const glm::vec3& barycentrics) {
+        const float     inv_w     = barycentrics.x * triangle.inv_w[0] + barycentrics.y * triangle.inv_w[1] + barycentrics.z * triangle.inv_w[2];
+        const glm::vec3 attribute = barycentrics.x * triangle.attribute[0] + barycentrics.y * triangle.attribute[1] + barycentrics.z * triangle.attribute[2];
+        return attribute / inv_w;
+    }
+
+} // end of namespace AliasFreeCPU
@@ -0,0 +1,323 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Batched shadow ray / triangle kernel
+//
+//  One occluder is tested against many samples stored as structure of arrays.
+//  The math is the one of intersectRayTriangle() and pointInsideTriangle() in
+//  3rd_pass_shadow_test.fs (plane intersection followed by two sign checks,
+//  same SHADOW_ACNE_EPSILON offset), evaluated in the same order without fused
+//  multiply-add, so all variants return the same bits as the scalar code.
+//
+//  The edge function variants evaluate EdgeFunctionsOccluded() the same way:
+//  three sign tests against the edge planes through the light and one plane
+//  test, each bit-identical to the scalar edge function code.
+//
+//  The widest instruction set enabled for the compiler is used:
+//  AVX-512 (16 samples), AVX2 (8 samples), SSE (4 samples), remaining samples
+//  go through the narrower variants down to the scalar path. Compile without
+//  floating-point contraction (-ffp-contract=off) when FMA is enabled, otherwise
+//  the scalar path may be fused and differ in the last bit.
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "alias_free_cpu.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   include <immintrin.h>
+#   define ALIASFREE_SHADOW_KERNEL_SSE
+#endif
+#if defined(__AVX2__)
+#   define ALIASFREE_SHADOW_KERNEL_AVX2
+#endif
+#if defined(__AVX512F__)
+#   define ALIASFREE_SHADOW_KERNEL_AVX512
+#endif
+
+namespace AliasFreeCPU {
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestScalar()
+    // Desc: Sets shadow[i] = 1 for every sample whose shadow ray hits the occluder
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestScalar(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const glm::vec3 p(x[i], y[i], z[i]);
+            if (IntersectRayTriangle(occluder, p + glm::normalize(-p) * SHADOW_ACNE_EPSILON, -p))
+                shadow[i] = 1;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestEdgeFunctionsScalar()
+    // Desc: ShadowTestScalar() by the precomputed edge functions of the occluder
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestEdgeFunctionsScalar(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (EdgeFunctionsOccluded(occluder, glm::vec3(x[i], y[i], z[i])))
+                shadow[i] = 1;
+        }
+    }
+
+// The vector variants share one body, only the register type and the intrinsics differ,
+// samples left over are passed to the next narrower variant (TAIL)
+#define ALIASFREE_SHADOW_KERNEL_BODY(WIDTH, TAIL, REG, SET1, LOAD, ADD, SUB, MUL, DIV, SQRT, XOR, MASK_T, GE, NLT, AND, MOVEMASK) \
+        const REG sign  = SET1(-0.0f);                                                              \
+        const REG zero  = SET1(0.0f);                                                               \
+        const REG one   = SET1(1.0f);                                                               \
+        const REG eps   = SET1(SHADOW_ACNE_EPSILON);                                                \
+        const REG nx    = SET1(occluder.plane.x);                                                   \
+        const REG ny    = SET1(occluder.plane.y);                                                   \
+        const REG nz    = SET1(occluder.plane.z);                                                   \
+        const REG d     = SET1(occluder.plane.w);                                                   \
+        const REG v0x   = SET1(occluder.vertices[0].x);                                             \
+        const REG v0y   = SET1(occluder.vertices[0].y);                                             \
+        const REG v0z   = SET1(occluder.vertices[0].z);                                             \
+        const REG v1x   = SET1(occluder.vertices[1].x);                                             \
+        const REG v1y   = SET1(occluder.vertices[1].y);                                             \
+        const REG v1z   = SET1(occluder.vertices[1].z);                                             \
+        const REG v2x   = SET1(occluder.vertices[2].x);                                             \
+        const REG v2y   = SET1(occluder.vertices[2].y);                                             \
+        const REG v2z   = SET1(occluder.vertices[2].z);                                             \
+                                                                                                    \
+        size_t i = 0;                                                                               \
+        for (; i + WIDTH <= count; i += WIDTH) {                                                    \
+            const REG px = LOAD(x + i);                                                             \
+            const REG py = LOAD(y + i);                                                             \
+            const REG pz = LOAD(z + i);                                                             \
+                                                                                                    \
+            /* Ray direction v = -p, origin a = p + normalize(-p) * SHADOW_ACNE_EPSILON */          \
+            const REG vx  = XOR(px, sign);                                                          \
+            const REG vy  = XOR(py, sign);                                                          \
+            const REG vz  = XOR(pz, sign);                                                          \
+            const REG inv = DIV(one, SQRT(ADD(ADD(MUL(vx, vx), MUL(vy, vy)), MUL(vz, vz))));        \
+            const REG ax  = ADD(px, MUL(MUL(vx, inv), eps));                                        \
+            const REG ay  = ADD(py, MUL(MUL(vy, inv), eps));                                        \
+            const REG az  = ADD(pz, MUL(MUL(vz, inv), eps));                                        \
+                                                                                                    \
+            /* Intersect plane */                                                                   \
+            const REG na = ADD(ADD(MUL(nx, ax), MUL(ny, ay)), MUL(nz, az));                         \
+            const REG nv = ADD(ADD(MUL(nx, vx), MUL(ny, vy)), MUL(nz, vz));                         \
+            const REG t  = DIV(SUB(d, na), nv);                                                     \
+            MASK_T hit   = GE(t, zero);                                                             \
+            if (MOVEMASK(hit) == 0)                                                                 \
+                continue;                                                                           \
+                                                                                                    \
+            /* Translate triangle so that the intersection lies at origin */                        \
+            const REG qx = ADD(ax, MUL(t, vx));                                                     \
+            const REG qy = ADD(ay, MUL(t, vy));                                                     \
+            const REG qz = ADD(az, MUL(t, vz));                                                     \
+            const REG ax_ = SUB(v0x, qx), ay_ = SUB(v0y, qy), az_ = SUB(v0z, qz);                  \
+            const REG bx_ = SUB(v1x, qx), by_ = SUB(v1y, qy), bz_ = SUB(v1z, qz);                  \
+            const REG cx_ = SUB(v2x, qx), cy_ = SUB(v2y, qy), cz_ = SUB(v2z, qz);                  \
+            const REG ab = ADD(ADD(MUL(ax_, bx_), MUL(ay_, by_)), MUL(az_, bz_));                   \
+            const REG ac = ADD(ADD(MUL(ax_, cx_), MUL(ay_, cy_)), MUL(az_, cz_));                   \
+            const REG bc = ADD(ADD(MUL(bx_, cx_), MUL(by_, cy_)), MUL(bz_, cz_));                   \
+            const REG cc = ADD(ADD(MUL(cx_, cx_), MUL(cy_, cy_)), MUL(cz_, cz_));                   \
+            const REG bb = ADD(ADD(MUL(bx_, bx_), MUL(by_, by_)), MUL(bz_, bz_));                   \
+                                                                                                    \
+            /* Both sign checks fail only for a negative value (NaN passes like in GLSL) */         \
+            hit = AND(hit, NLT(SUB(MUL(bc, ac), MUL(cc, ab)), zero));                               \
+            hit = AND(hit, NLT(SUB(MUL(ab, bc), MUL(ac, bb)), zero));                               \
+            for (uint32_t bits = static_cast<uint32_t>(MOVEMASK(hit)); bits != 0; bits &= bits - 1) \
+                shadow[i + ShadowKernelLowestBit(bits)] = 1;                                        \
+        }                                                                                           \
+        TAIL(occluder, x + i, y + i, z + i, shadow + i, count - i);
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowKernelLowestBit()
+    // Desc: Index of the lowest set bit, bits != 0
+    //-----------------------------------------------------------------------------
+    inline uint32_t ShadowKernelLowestBit(uint32_t bits) {
+        uint32_t index = 0;
+        while ((bits & 1u) == 0) {
+            bits >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+#ifdef ALIASFREE_SHADOW_KERNEL_SSE
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestSSE()
+    // Desc: 4 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestSSE(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_SHADOW_KERNEL_BODY(4, ShadowTestScalar, __m128, _mm_set1_ps, _mm_loadu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps,
+                                     _mm_sqrt_ps, _mm_xor_ps, __m128, _mm_cmpge_ps, _mm_cmpnlt_ps, _mm_and_ps, _mm_movemask_ps)
+    }
+#endif
+
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX2
+#   define ALIASFREE_AVX_GE(a, b)  _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#   define ALIASFREE_AVX_NLT(a, b) _mm256_cmp_ps(a, b, _CMP_NLT_UQ)
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestAVX2()
+    // Desc: 8 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestAVX2(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_SHADOW_KERNEL_BODY(8, ShadowTestSSE, __m256, _mm256_set1_ps, _mm256_loadu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps,
+                                     _mm256_sqrt_ps, _mm256_xor_ps, __m256, ALIASFREE_AVX_GE, ALIASFREE_AVX_NLT, _mm256_and_ps, _mm256_movemask_ps)
+    }
+#   undef ALIASFREE_AVX_GE
+#   undef ALIASFREE_AVX_NLT
+#endif
+
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX512
+#   define ALIASFREE_AVX512_XOR(a, b) _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)))
+#   define ALIASFREE_AVX512_GE(a, b)  _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#   define ALIASFREE_AVX512_NLT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_NLT_UQ)
+#   define ALIASFREE_AVX512_AND(a, b) static_cast<__mmask16>((a) & (b))
+#   define ALIASFREE_AVX512_MASK(a)   static_cast<uint32_t>(a)
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestAVX512()
+    // Desc: 16 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestAVX512(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_SHADOW_KERNEL_BODY(16, ShadowTestAVX2, __m512, _mm512_set1_ps, _mm512_loadu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps,
+                                     _mm512_sqrt_ps, ALIASFREE_AVX512_XOR, __mmask16, ALIASFREE_AVX512_GE, ALIASFREE_AVX512_NLT,
+                                     ALIASFREE_AVX512_AND, ALIASFREE_AVX512_MASK)
+    }
+#   undef ALIASFREE_AVX512_XOR
+#   undef ALIASFREE_AVX512_GE
+#   undef ALIASFREE_AVX512_NLT
+#   undef ALIASFREE_AVX512_AND
+#   undef ALIASFREE_AVX512_MASK
+#endif
+
+// Same structure for the edge function variants
+#define ALIASFREE_EDGE_KERNEL_BODY(WIDTH, TAIL, REG, SET1, LOAD, ADD, SUB, MUL, DIV, SQRT, MASK_T, GE, AND, MOVEMASK)         \
+        const REG zero  = SET1(0.0f);                                                               \
+        const REG one   = SET1(1.0f);                                                               \
+        const REG eps   = SET1(SHADOW_ACNE_EPSILON);                                                \
+        const REG e0x   = SET1(occluder.edges[0].x);                                                \
+        const REG e0y   = SET1(occluder.edges[0].y);                                                \
+        const REG e0z   = SET1(occluder.edges[0].z);                                                \
+        const REG e1x   = SET1(occluder.edges[1].x);                                                \
+        const REG e1y   = SET1(occluder.edges[1].y);                                                \
+        const REG e1z   = SET1(occluder.edges[1].z);                                                \
+        const REG e2x   = SET1(occluder.edges[2].x);                                                \
+        const REG e2y   = SET1(occluder.edges[2].y);                                                \
+        const REG e2z   = SET1(occluder.edges[2].z);                                                \
+        const REG qx    = SET1(occluder.edges[0].w);                                                \
+        const REG qy    = SET1(occluder.edges[1].w);                                                \
+        const REG qz    = SET1(occluder.edges[2].w);                                                \
+                                                                                                    \
+        size_t i = 0;                                                                               \
+        for (; i + WIDTH <= count; i += WIDTH) {                                                    \
+            const REG px = LOAD(x + i);                                                             \
+            const REG py = LOAD(y + i);                                                             \
+            const REG pz = LOAD(z + i);                                                             \
+                                                                                                    \
+            /* Light ray through the triangle, all samples outside of an edge end the iteration */  \
+            MASK_T hit = GE(ADD(ADD(MUL(e0x, px), MUL(e0y, py)), MUL(e0z, pz)), zero);              \
+            hit = AND(hit, GE(ADD(ADD(MUL(e1x, px), MUL(e1y, py)), MUL(e1z, pz)), zero));           \
+            if (MOVEMASK(hit) == 0)                                                                 \
+                continue;                                                                           \
+            hit = AND(hit, GE(ADD(ADD(MUL(e2x, px), MUL(e2y, py)), MUL(e2z, pz)), zero));           \
+                                                                                                    \
+            /* Plane between the light and the offset ray origin */                                 \
+            const REG w   = ADD(ADD(MUL(qx, px), MUL(qy, py)), MUL(qz, pz));                        \
+            const REG inv = DIV(one, SQRT(ADD(ADD(MUL(px, px), MUL(py, py)), MUL(pz, pz))));        \
+            hit = AND(hit, GE(MUL(w, SUB(one, MUL(eps, inv))), one));                               \
+            for (uint32_t bits = static_cast<uint32_t>(MOVEMASK(hit)); bits != 0; bits &= bits - 1) \
+                shadow[i + ShadowKernelLowestBit(bits)] = 1;                                        \
+        }                                                                                           \
+        TAIL(occluder, x + i, y + i, z + i, shadow + i, count - i);
+
+#ifdef ALIASFREE_SHADOW_KERNEL_SSE
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestEdgeFunctionsSSE()
+    // Desc: 4 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestEdgeFunctionsSSE(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_EDGE_KERNEL_BODY(4, ShadowTestEdgeFunctionsScalar, __m128, _mm_set1_ps, _mm_loadu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps,
+                                   _mm_sqrt_ps, __m128, _mm_cmpge_ps, _mm_and_ps, _mm_movemask_ps)
+    }
+#endif
+
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX2
+#   define ALIASFREE_AVX_GE(a, b)  _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestEdgeFunctionsAVX2()
+    // Desc: 8 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestEdgeFunctionsAVX2(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_EDGE_KERNEL_BODY(8, ShadowTestEdgeFunctionsSSE, __m256, _mm256_set1_ps, _mm256_loadu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps,
+                                   _mm256_sqrt_ps, __m256, ALIASFREE_AVX_GE, _mm256_and_ps, _mm256_movemask_ps)
+    }
+#   undef ALIASFREE_AVX_GE
+#endif
+
+#ifdef ALIASFREE_SHADOW_KERNEL_AVX512
+#   define ALIASFREE_AVX512_GE(a, b)  _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#   define ALIASFREE_AVX512_AND(a, b) static_cast<__mmask16>((a) & (b))
+#   define ALIASFREE_AVX512_MASK(a)   static_cast<uint32_t>(a)
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestEdgeFunctionsAVX512()
+    // Desc: 16 samples per iteration
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestEdgeFunctionsAVX512(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+        ALIASFREE_EDGE_KERNEL_BODY(16, ShadowTestEdgeFunctionsAVX2, __m512, _mm512_set1_ps, _mm512_loadu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps,
+                                   _mm512_sqrt_ps, __mmask16, ALIASFREE_AVX512_GE, ALIASFREE_AVX512_AND, ALIASFREE_AVX512_MASK)
+    }
+#   undef ALIASFREE_AVX512_GE
+#   undef ALIASFREE_AVX512_AND
+#   undef ALIASFREE_AVX512_MASK
+#endif
+
+#undef ALIASFREE_SHADOW_KERNEL_BODY
+#undef ALIASFREE_EDGE_KERNEL_BODY
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTest()
+    // Desc: Widest available variant
+    //-----------------------------------------------------------------------------
+    inline void ShadowTest(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+#if defined(ALIASFREE_SHADOW_KERNEL_AVX512)
+        ShadowTestAVX512(occluder, x, y, z, shadow, count);
+#elif defined(ALIASFREE_SHADOW_KERNEL_AVX2)
+        ShadowTestAVX2(occluder, x, y, z, shadow, count);
+#elif defined(ALIASFREE_SHADOW_KERNEL_SSE)
+        ShadowTestSSE(occluder, x, y, z, shadow, count);
+#else
+        ShadowTestScalar(occluder, x, y, z, shadow, count);
+#endif
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestEdgeFunctions()
+    // Desc: Widest available edge function variant
+    //-----------------------------------------------------------------------------
+    inline void ShadowTestEdgeFunctions(const Occluder& occluder, const float* x, const float* y, const float* z, uint8_t* shadow, size_t count) {
+#if defined(ALIASFREE_SHADOW_KERNEL_AVX512)
+        ShadowTestEdgeFunctionsAVX512(occluder, x, y, z, shadow, count);
+#elif defined(ALIASFREE_SHADOW_KERNEL_AVX2)
+        ShadowTestEdgeFunctionsAVX2(occluder, x, y, z, shadow, count);
+#elif defined(ALIASFREE_SHADOW_KERNEL_SSE)
+        ShadowTestEdgeFunctionsSSE(occluder, x, y, z, shadow, count);
+#else
+        ShadowTestEdgeFunctionsScalar(occluder, x, y, z, shadow, count);
+#endif
+    }
+
+    //-----------------------------------------------------------------------------
+    // Name: ShadowTestWidth()
+    // Desc: Number of samples processed at once by ShadowTest()
+    //-----------------------------------------------------------------------------
+    inline int ShadowTestWidth() {
+#if defined(ALIASFREE_SHADOW_KERNEL_AVX512)
+        return 16;
+#elif defined(ALIASFREE_SHADOW_KERNEL_AVX2)
+        return 8;
+#elif defined(ALIASFREE_SHADOW_KERNEL_SSE)
+        return 4;
+#else
+        return 1;
+#endif
+    }
+
+} // end of namespace AliasFreeCPU
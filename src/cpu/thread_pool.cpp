@@ -0,0 +1,158 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Work-stealing thread pool
+//-----------------------------------------------------------------------------
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace AliasFreeCPU {
+
+    // Index of the pool queue owned by the current thread (-1 ... thread outside of the pool)
+    static thread_local int t_WorkerIndex = -1;
+
+    //-----------------------------------------------------------------------------
+    // Name: ThreadPool()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    ThreadPool::ThreadPool(unsigned int num_threads) : queued(0), stop(false) {
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        // The thread calling parallelFor() works too, so one thread less is spawned
+        for (unsigned int i = 0; i < num_threads; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue));
+        for (unsigned int i = 0; i + 1 < num_threads; i++)
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: ~ThreadPool()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: parallelFor()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+        if (count == 0)
+            return;
+
+        grain = std::max<size_t>(grain, 1);
+        const size_t num_tasks = (count + grain - 1) / grain;
+        if (workers.empty() || (num_tasks == 1)) {
+            for (size_t begin = 0; begin < count; begin += grain)
+                body(begin, std::min(count, begin + grain));
+            return;
+        }
+
+        Group group;
+        group.pending = num_tasks;
+
+        // Every queue gets a contiguous block of ranges, the calling thread's queue the first one
+        const unsigned int own_queue  = (t_WorkerIndex >= 0) ? static_cast<unsigned int>(t_WorkerIndex) : static_cast<unsigned int>(workers.size());
+        const size_t       num_queues = queues.size();
+        for (size_t q = 0; q < num_queues; q++) {
+            const size_t first = num_tasks * q / num_queues;
+            const size_t last  = num_tasks * (q + 1) / num_queues;
+            Queue& queue = *queues[(own_queue + q) % num_queues];
+
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            for (size_t t = first; t < last; t++) {
+                const Task task = { &body, &group, t * grain, std::min(count, (t + 1) * grain) };
+                queue.tasks.push_back(task);
+            }
+        }
+        queued += num_tasks;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+        }
+        wake.notify_all();
+
+        // Help with the work (including tasks of other groups) until the whole group is done
+        Task task;
+        while (group.pending.load(std::memory_order_acquire) != 0) {
+            if (popTask(own_queue, task))
+                runTask(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: workerLoop()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void ThreadPool::workerLoop(unsigned int index) {
+        t_WorkerIndex = static_cast<int>(index);
+
+        Task task;
+        for (;;) {
+            if (popTask(index, task)) {
+                runTask(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock, [this]() { return stop || (queued.load() > 0); });
+            if (stop && (queued.load() == 0))
+                return;
+        }
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: popTask()
+    // Desc: Takes the newest task of the own queue or steals the oldest task of another queue
+    //-----------------------------------------------------------------------------
+    bool ThreadPool::popTask(unsigned int index, Task& task) {
+        {
+            Queue& queue = *queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+
+        const size_t num_queues = queues.size();
+        for (size_t i = 1; i < num_queues; i++) {
+            Queue& queue = *queues[(index + i) % num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    //-----------------------------------------------------------------------------
+    // Name: runTask()
+    // Desc:
+    //-----------------------------------------------------------------------------
+    void ThreadPool::runTask(const Task& task) {
+        (*task.body)(task.begin, task.end);
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+} // end of namespace AliasFreeCPU
@@ -0,0 +1,66 @@
+//-----------------------------------------------------------------------------
+//  Alias Free Shadow Mapping - CPU reference engine
+//  Work-stealing thread pool
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AliasFreeCPU {
+
+    // Thread pool with one task deque per worker. A worker takes tasks from the back
+    // of its own deque and steals from the front of the other deques when it runs dry,
+    // so uneven chunks (e.g. tiles with long lists) are balanced automatically.
+    class ThreadPool {
+    public:
+        // num_threads == 0 ... one worker per hardware thread
+        explicit ThreadPool(unsigned int num_threads = 0);
+        ~ThreadPool();
+
+        // Number of threads executing tasks (workers + the calling thread)
+        unsigned int size() const {
+            return static_cast<unsigned int>(workers.size()) + 1;
+        }
+
+        // Calls body(begin, end) for consecutive ranges of at most grain items covering [0, count).
+        // The calling thread takes part in the work and the call returns when all ranges are done.
+        void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    private:
+        struct Group {
+            std::atomic<size_t> pending;
+        };
+        struct Task {
+            std::function<void(size_t, size_t)> const* body;
+            Group* group;
+            size_t  begin;
+            size_t  end;
+        };
+        struct Queue {
+            std::mutex       mutex;
+            std::deque<Task> tasks;
+        };
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+
+        void workerLoop(unsigned int index);
+        bool popTask(unsigned int index, Task& task);
+        void runTask(const Task& task);
+
+        std::vector<std::thread>            workers;
+        std::vector<std::unique_ptr<Queue>> queues;      // workers.size() worker queues + one queue for external callers
+        std::atomic<size_t>                 queued;      // Number of tasks waiting in all queues
+        std::mutex                          wake_mutex;
+        std::condition_variable             wake;
+        bool                                stop;
+    };
+
+} // end of namespace AliasFreeCPU
@@ -0,0 +1,7 @@
+#version 430 core
+
+// Depth-only passes (depth prepass, covered pixel count), an empty fragment shader instead of none keeps the draws
+// valid with the integer visibility buffer attached (Mesa drops them otherwise)
+
+void main(void) {
+}
@@ -0,0 +1,49 @@
+#version 430 core
+
+// Bounds of the camera samples in the light view space used to fit the light frustum: x/-z and y/-z of the samples
+// in front of the light (the view plane at z = -1) and their largest distance from the light
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Min x/-z, min y/-z, min -x/-z, min -y/-z, max -z (order preserving uint encoding of the floats), number of samples
+layout (std430, binding = 4) buffer LightBounds {
+    uint bounds[6];
+};
+
+shared uint s_Bounds[6];
+
+// Float encoded as uint with the same order
+uint orderedUint(float value) {
+    uint bits = floatBitsToUint(value);
+    return ((bits & 0x80000000U) != 0U) ? ~bits : (bits | 0x80000000U);
+}
+
+void main(void) {
+
+    if (gl_LocalInvocationIndex < 6U)
+        s_Bounds[gl_LocalInvocationIndex] = (gl_LocalInvocationIndex < 4U) ? 0xFFFFFFFFU : 0U;
+    barrier();
+
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(coord, cameraSampleSize()))) {
+        vec4 sample_pos = fetchCameraSample(coord);
+        if ((sample_pos.w == 1.0) && (sample_pos.z < 0.0)) {
+            vec2 plane_pos = sample_pos.xy / -sample_pos.z;
+            atomicMin(s_Bounds[0], orderedUint(plane_pos.x));
+            atomicMin(s_Bounds[1], orderedUint(plane_pos.y));
+            atomicMin(s_Bounds[2], orderedUint(-plane_pos.x));
+            atomicMin(s_Bounds[3], orderedUint(-plane_pos.y));
+            atomicMax(s_Bounds[4], orderedUint(-sample_pos.z));
+            atomicAdd(s_Bounds[5], 1U);
+        }
+    }
+    barrier();
+
+    // One global update per work group
+    if ((gl_LocalInvocationIndex == 0U) && (s_Bounds[5] > 0U)) {
+        for (int i = 0; i < 4; i++)
+            atomicMin(bounds[i], s_Bounds[i]);
+        atomicMax(bounds[4], s_Bounds[4]);
+        atomicAdd(bounds[5], s_Bounds[5]);
+    }
+}
@@ -0,0 +1,91 @@
+#version 430 core
+
+// Length of the sample list of every light texel: histogram of the lengths, the longest list and the number of
+// samples. Run after the list generation pass on the first layer, the results are read back asynchronously.
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Light texel grid resolution
+layout (location = 2) uniform int u_Resolution;
+
+#ifdef COMPACTED_LIST
+// First sample of every light texel of the layers (layers * resolution^2 + 1 items)
+layout (std430, binding = 0) readonly buffer TexelOffsets {
+    uint texel_offsets[];
+};
+#else
+// Head pointers of the layers
+layout (binding = 2) uniform usampler2DArray head_pointer_image;
+
+// Linked list nodes, only the pointer to the next node (x) is read
+#if defined(COMPACT_NODES) && defined(PIXEL_NODE_INDEX)
+layout (binding = 2, r32ui) uniform readonly uimageBuffer list_buffer;
+#elif defined(COMPACT_NODES)
+layout (binding = 2, rg32ui) uniform readonly uimageBuffer list_buffer;
+#else
+layout (binding = 2, rgba32ui) uniform readonly uimageBuffer list_buffer;
+#endif
+
+// Generation of the current frame, pointers written in older frames mark the end of the list
+layout (location = 5) uniform uint u_Generation;
+
+const uint NODE_INDEX_MASK = (1U << NODE_INDEX_BITS) - 1U;
+
+// Stops the traversal of a corrupted list
+const uint MAX_LIST_LENGTH = 1U << 20;
+#endif
+
+const uint NUM_BINS = 256U;
+
+// frame, resolution and the atomic counter before/after the list generation are written by the application, the
+// last bin counts the lists with NUM_BINS - 1 or more samples
+layout (std430, binding = 5) buffer ListStatistics {
+    uint frame;
+    uint resolution;
+    uint counter_begin;
+    uint counter_end;
+    uint max_length;
+    uint num_samples;
+    uint histogram[NUM_BINS];
+};
+
+shared uint s_Histogram[NUM_BINS];
+shared uint s_MaxLength;
+shared uint s_NumSamples;
+
+void main(void) {
+
+    s_Histogram[gl_LocalInvocationIndex] = 0U;
+    if (gl_LocalInvocationIndex == 0U) {
+        s_MaxLength  = 0U;
+        s_NumSamples = 0U;
+    }
+    barrier();
+
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(texel, ivec2(u_Resolution)))) {
+#ifdef COMPACTED_LIST
+        uint index  = uint(texel.y) * uint(u_Resolution) + uint(texel.x);
+        uint length = texel_offsets[index + 1] - texel_offsets[index];
+#else
+        uint length     = 0U;
+        uint curr_index = texelFetch(head_pointer_image, ivec3(texel, 0), 0).x;
+        while (((curr_index >> NODE_INDEX_BITS) == u_Generation) && (length < MAX_LIST_LENGTH)) {
+            curr_index = imageLoad(list_buffer, int(curr_index & NODE_INDEX_MASK)).x;
+            length++;
+        }
+#endif
+        atomicAdd(s_Histogram[min(length, NUM_BINS - 1U)], 1U);
+        atomicMax(s_MaxLength, length);
+        atomicAdd(s_NumSamples, length);
+    }
+    barrier();
+
+    // One global update per work group and bin
+    if (s_Histogram[gl_LocalInvocationIndex] > 0U)
+        atomicAdd(histogram[gl_LocalInvocationIndex], s_Histogram[gl_LocalInvocationIndex]);
+    if (gl_LocalInvocationIndex == 0U) {
+        atomicMax(max_length, s_MaxLength);
+        atomicAdd(num_samples, s_NumSamples);
+    }
+}
@@ -0,0 +1,57 @@
+#version 430 core
+
+// Exclusive prefix sum of an uint array, every work group processes a block of PREFIX_SUM_BLOCK_SIZE items:
+//   1) block scan       ... items are replaced by the exclusive sum inside the block, block totals are stored in block_sums
+//   2) (block_sums are scanned recursively)
+//   3) ADD_BLOCK_SUMS   ... scanned block totals are added to the items of the block
+
+#define THREADS 512
+#define PREFIX_SUM_BLOCK_SIZE (2 * THREADS)
+
+layout (local_size_x = THREADS) in;
+
+layout (std430, binding = 0) buffer Data {
+    uint data[];
+};
+
+layout (std430, binding = 1) buffer BlockSums {
+    uint block_sums[];
+};
+
+// Number of items in data
+layout (location = 0) uniform uint u_Count;
+
+shared uint s_Sums[THREADS];
+
+void main(void) {
+
+    const uint thread = gl_LocalInvocationID.x;
+    const uint first  = gl_WorkGroupID.x * PREFIX_SUM_BLOCK_SIZE + 2 * thread;
+
+#ifdef ADD_BLOCK_SUMS
+    const uint offset = block_sums[gl_WorkGroupID.x];
+    if (first < u_Count)     data[first]     += offset;
+    if (first + 1 < u_Count) data[first + 1] += offset;
+#else
+    // Every thread sums a pair of items ...
+    const uint a = (first < u_Count)     ? data[first]     : 0U;
+    const uint b = (first + 1 < u_Count) ? data[first + 1] : 0U;
+    s_Sums[thread] = a + b;
+    barrier();
+
+    // ... followed by the inclusive scan of the pair sums (Hillis-Steele)
+    for (uint stride = 1; stride < THREADS; stride <<= 1) {
+        const uint value = (thread >= stride) ? s_Sums[thread - stride] : 0U;
+        barrier();
+        s_Sums[thread] += value;
+        barrier();
+    }
+
+    const uint exclusive = s_Sums[thread] - (a + b);
+    if (first < u_Count)     data[first]     = exclusive;
+    if (first + 1 < u_Count) data[first + 1] = exclusive + a;
+
+    if (thread == THREADS - 1)
+        block_sums[gl_WorkGroupID.x] = s_Sums[thread];
+#endif
+}
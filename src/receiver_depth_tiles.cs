@@ -0,0 +1,31 @@
+#version 430 core
+
+// Coarse level of the receiver depth tiles, every item is the maximum of 4x4 fine tiles (the tagged values of older
+// generations are smaller, so the maximum also selects the current generation), the z dimension are the layers
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// Maximum light distance of the receivers in 8x8 light texels (generation << 24 | upper 24 bits of the float)
+layout (binding = 5, r32ui) uniform readonly uimage2DArray receiver_depth_tiles;
+
+// Maximum light distance of the receivers in 32x32 light texels
+layout (binding = 6, r32ui) uniform writeonly uimage2DArray receiver_depth_tiles_coarse;
+
+void main(void) {
+
+    ivec2 coarse_tile = ivec2(gl_GlobalInvocationID.xy);
+    int   layer       = int(gl_GlobalInvocationID.z);
+    if (any(greaterThanEqual(coarse_tile, imageSize(receiver_depth_tiles_coarse).xy))) return;
+
+    ivec2 size  = imageSize(receiver_depth_tiles).xy;
+    uint  value = 0U;
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            ivec2 tile = coarse_tile * 4 + ivec2(x, y);
+            if (all(lessThan(tile, size)))
+                value = max(value, imageLoad(receiver_depth_tiles, ivec3(tile, layer)).x);
+        }
+    }
+
+    imageStore(receiver_depth_tiles_coarse, ivec3(coarse_tile, layer), uvec4(value));
+}
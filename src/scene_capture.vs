@@ -0,0 +1,18 @@
+#version 430 core
+
+layout (location = 0) in vec4 a_Vertex;
+layout (location = 1) in vec3 a_Normal;
+layout (location = 2) in vec2 a_TexCoord;
+
+// Object space position captured by transform feedback into the first buffer, the shading attributes of the
+// visibility buffer pass into the second one (gl_NextBuffer)
+out vec3 v_Position;
+out vec3 v_Normal;
+out vec2 v_TexCoord;
+
+void main(void) {
+    v_Position  = a_Vertex.xyz;
+    v_Normal    = a_Normal;
+    v_TexCoord  = a_TexCoord;
+    gl_Position = a_Vertex;
+}
@@ -12,13 +12,17 @@
 //    [c]     ... compile shaders
 //    [mouse] ... scene rotation (left button)
 //-----------------------------------------------------------------------------
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include "common.h"
+#include "cpu/alias_free_cpu.h"
+#include "glm/gtc/half_float.hpp"
 
 // GLOBAL CONSTANTS____________________________________________________________
 const char* TEXTURE_FILE_NAME = "../shared/textures/metal01.raw";
-enum eTextureType { Diffuse = 0, DepthMap, ZBuffer, ZBufferShadow, VisibilityMap, HeadPointerImage, ListBuffer, ShadowMap, LightingMap, NumTextureTypes };
+enum eTextureType { Diffuse = 0, DepthMap, ZBuffer, ZBufferShadow, VisibilityMap, HeadPointerImage, ListBuffer, ShadowMap, LightingMap, OccupancyStencil, ReceiverDepthTiles, ReceiverDepthTilesCoarse, VisibilityReference, SceneNormals, HeadPointerView, NumTextureTypes };
 
 enum eAlgorithmPass {
     DepthTextureGeneration = 0,
@@ -27,9 +31,143 @@ enum eAlgorithmPass {
     RenderScene,
     VisibilityMapGeneration,
     ListBufferGeneration,
+    ListBufferGenerationPixelNodes,
+    ListBufferGenerationCompactNodes,
+    ListBufferGenerationCompactPixelNodes,
+    SceneCapture,
+    CompactedListCount,
+    CompactedListScatter,
+    ShadowTestAliasFreeCompacted,
+    ShadowTestAliasFreeCompactNodes,
+    ShadowTestAliasFreeCompactPixelNodes,
+    PrefixSumBlocks,
+    PrefixSumAdd,
+    LightTexelOccupancy,
+    LightTexelOccupancyCompacted,
+    ReceiverDepthTilesReduce,
+    LightFrustumBounds,
+    ListStatistics,
+    ListStatisticsCompactNodes,
+    ListStatisticsCompactPixelNodes,
+    ListStatisticsCompacted,
+    ShadowTestAliasFreeCompactedBalanced,
+    ShadowTestHeavyLists,
+    ShadowTestAliasFreePulled,
+    ShadowTestAliasFreeCompactedPulled,
+    ShadowTestAliasFreeCompactNodesPulled,
+    ShadowTestAliasFreeCompactPixelNodesPulled,
+    ShadowTestAliasFreeCompactedBalancedPulled,
+    ShadowTestAliasFreeLayered,
+    ShadowTestAliasFreeCompactedLayered,
+    ShadowTestAliasFreeCompactNodesLayered,
+    ShadowTestAliasFreeCompactPixelNodesLayered,
+    ShadowTestAliasFreeCompactedBalancedLayered,
+    ShadowTestAliasFreePulledLayered,
+    ShadowTestAliasFreeCompactedPulledLayered,
+    ShadowTestAliasFreeCompactNodesPulledLayered,
+    ShadowTestAliasFreeCompactPixelNodesPulledLayered,
+    ShadowTestAliasFreeCompactedBalancedPulledLayered,
+    TriangleSetup,
+    DepthPrepass,
+    VisibilityMapGenerationFused,
+    VisibilityMapGenerationFusedPixelNodes,
+    VisibilityMapGenerationFusedCompactNodes,
+    VisibilityMapGenerationFusedCompactPixelNodes,
+    DepthPrepassStandard,
+    CoveredPixels,
+    VisibilityBufferGeneration,
+    VisibilityBufferPrepass,
     NumPasses
 };
 
+// Storage of the samples sorted into the light texels (pass 2 & 3)
+enum eListMode { LinkedList = 0, CompactedList, NumListModes };
+
+// Camera samples of pass 1, light view space positions (RGBA32F), a visibility buffer resolved by the light space
+// triangles (RG32UI, triangle index + 1 and barycentrics), fp16 positions (RGBA16F) or the camera view space depth
+// unprojected to the light view space (R32F), fetchCameraSample() in alias_free_common.glsl
+enum eVisibilityEncoding { VisibilityPositions = 0, VisibilityBuffer, VisibilityHalf, VisibilityDepth, NumVisibilityEncodings };
+
+const GLuint PREFIX_SUM_BLOCK_SIZE = 1024; // Items scanned by one work group of prefix_sum.cs
+
+// Head pointers store generation << NODE_INDEX_BITS | node index (2nd_pass_list_buffer_generation.fs)
+const GLuint NODE_INDEX_BITS = 24;
+const GLuint MAX_GENERATION  = (1u << (32 - NODE_INDEX_BITS)) - 1;
+
+// Light texels per side of the receiver depth tiles (fine level written in pass 2, coarse level reduced from it)
+const GLint RECEIVER_TILE_SIZE        = 8;
+const GLint RECEIVER_TILE_SIZE_COARSE = 32;
+
+// Light frustum fitted to the camera samples (bounds reduced on GPU and read back a few frames later, or computed on CPU)
+enum eLightFit { FixedLightFrustum = 0, GPULightFit, CPULightFit, NumLightFits };
+
+const float LIGHT_NEAR                 = 1.0f;     // Near and far plane of the fixed light frustum, the fitted frustum lies inside
+const float LIGHT_FAR                  = 1000.0f;
+const float LIGHT_FIT_MARGIN           = 0.05f;    // Relative margin of the GPU fitted frustum, covers the motion during the readback latency
+
+// Automatic light grid resolution, the mean list length per occupied light texel is kept inside a band
+// (one doubling/halving changes the mean at most 4x, the band ratio > 4 keeps the new resolution inside it)
+const float AUTO_RESOLUTION_MIN_LIST = 1.5f;
+const float AUTO_RESOLUTION_MAX_LIST = 8.0f;
+const int   AUTO_RESOLUTION_FRAMES   = 8;    // Consecutive frames outside of the band before the resolution changes
+const int   AUTO_RESOLUTION_COOLDOWN = 16;   // Frames without change after a reallocation (the statistics queries are a few frames old)
+const GLint AUTO_RESOLUTION_MIN      = 128;
+const GLint AUTO_RESOLUTION_MAX      = 2048;
+
+// Load balanced shadow test of the compacted lists, fragments over longer lists are handed over to the work groups
+// of 3rd_pass_shadow_test_heavy_lists.cs (HEAVY_LIST_LENGTH in 3rd_pass_shadow_test.fs)
+const GLuint MAX_HEAVY_LISTS         = 1u << 16;  // Capacity of the hand-over buffer, the shadow test tests the rest of the lists itself
+const GLuint HEAVY_LIST_BYTES        = 64;        // std430 size of HeavyList
+const GLuint HEAVY_LIST_WORK_GROUPS  = 512;       // Persistent work groups of the heavy list pass
+
+// Packed shadow results, one bit per pixel in 8x4 pixel tiles (shadowWord() and shadowBit() in 3rd_pass_shadow_test.fs)
+const GLint SHADOW_TILE_WIDTH  = 8;
+const GLint SHADOW_TILE_HEIGHT = 4;
+
+// CPU vs GPU comparison (--compare), allowed mismatches per sample. Passes 2 - 4 of the CPU reproduce the GPU shadow
+// map bits for the same samples. Only the fp16 samples of --half-positions snap onto occluder edges, the sign of the
+// plane test is then decided by the rounding of the GPU compiler (fused multiply-add, measured 1.7e-5 of the samples).
+// The samples of the CPU pass 1 differ from the GPU interpolation by float rounding, the shadow test of the samples
+// whose shadow ray grazes an occluder edge within this distance flips (measured 4e-6), the fp16 samples differ by
+// the encoding error (measured 5e-4, see --encoding-error).
+const float CPU_HALF_TIE_TOLERANCE      = 4e-5f;  // Passes 2 - 4 on the fp16 samples of the GPU (0 for the other encodings)
+const float CPU_MISMATCH_TOLERANCE      = 1e-4f;  // Pass 1 of the CPU
+const float CPU_HALF_MISMATCH_TOLERANCE = 1e-3f;  // Pass 1 of the CPU against the fp16 samples
+
+// Additional lights share the samples of pass 1, one bit of the light masks in the shadow map per light (a bit plane
+// of the packed shadow results)
+const GLint MAX_LIGHTS             = 32;
+const float ADDITIONAL_LIGHT_ANGLE = 30.0f;   // Angle between the main light and the default additional lights [deg]
+const float LIGHT_GOLDEN_ANGLE     = 137.5f;  // Turn of the default additional lights about the main light direction [deg]
+
+// Point light, the 90 degree light frustum is turned to the six faces of a cube around the light
+const GLint NUM_CUBE_FACES = 6;
+
+// Directional light, orthographic light grids of camera distance ranges (practical split scheme up to the distance)
+const GLint MAX_CASCADES          = 4;
+const float CASCADE_MAX_DISTANCE  = 100.0f;  // Camera distance covered by the cascades (the camera far plane is nearer)
+const float CASCADE_SPLIT_LAMBDA  = 0.5f;    // Weight of the logarithmic splits, the uniform splits have 1 - lambda
+
+// Lights, cube faces or cascades are built in batches of light views, the lists of a view are in a layer of the head
+// pointer image and of the other light texel buffers, the layered shadow test draws a batch at once (geometry shader
+// invocations or instances, MAX_VIEW_LAYERS in the shaders)
+const GLint      MAX_VIEW_LAYERS = 32;
+const GLsizeiptr MAX_LAYER_BYTES = GLsizeiptr(256) << 20;  // Light texel buffers of all layers, the other views go to the next batches
+static_assert((MAX_VIEW_LAYERS >= MAX_LIGHTS) && (MAX_VIEW_LAYERS >= NUM_CUBE_FACES) && (MAX_VIEW_LAYERS >= MAX_CASCADES), "Views of a frame exceed the view buffer");
+
+// Light view of the lists of a layer, layout of LightView in alias_free_common.glsl (std430)
+struct LightView {
+    glm::mat4 sample_to_light;  // Stored samples (light view space of the main light) to the light view space
+    glm::mat4 projection;
+    glm::vec4 depth_plane;      // Camera distance of the stored samples (cascades)
+    glm::vec2 depth_range;      // Camera distance range of the samples of the view, (0, 0) ... all samples
+    GLuint    light_bit;        // Bit of the light in the light masks of the shadow map, 0 ... single light tagged by the generation
+    GLuint    padding;
+};
+
+// Histogram bins of the light texel list lengths (list_statistics.cs), the last bin counts the longer lists
+const GLuint NUM_LIST_LENGTH_BINS = 256;
+
 // GLOBAL VARIABLES__________________________________________________________________________________________________________________
 bool      g_ShowDepthTexture          = true;  // Show/hide depth texture
 GLint     g_Resolution                = 1024;  // FBO size in pixels
@@ -40,14 +178,128 @@ GLuint    g_ShadowTestFramebuffer = 0;
 
 GLuint    g_ProgramId[NumPasses]      =  {0};  // shader program IDs
 
-GLint     g_ShadowMapsAlgo = 0; // The index of the currently running algorithm
+GLint     g_ShadowMapsAlgo = 0; // The index of the currently running algorithm (0 ... depth map, 1 ... alias-free, 2 ... alias-free on CPU)
 bool      g_Switch     = false; // Variable saving algorithm switching.
 
+AliasFreeCPU::Engine*  g_CPUEngine          = nullptr; // CPU reference engine of the alias-free shadow maps
+std::vector<glm::vec3> g_SceneTriangles;               // Scene triangles captured for the CPU engine (3 vertices per triangle)
+GLuint                 g_SceneTriangleBuffer = 0;      // Object space scene triangles captured by transform feedback
+GLuint                 g_NumSceneTriangles   = 0;
+GLuint                 g_SceneAttributeBuffer = 0;     // Normals and texture coordinates of the captured vertices (visibility buffer pass)
+bool                   g_CPUUseGPUSamples   = false;   // CPU engine uses the visibility map generated by the GPU
+bool                   g_CPUCompare         = false;   // Run the GPU shadow test too and compare shadow maps
+GLuint                 g_CPUMismatches      = 0;       // Number of pixels with different GPU and CPU shadow test result
+GLuint                 g_CPUMismatchBound   = 0;       // Allowed mismatches (CPU_MISMATCH_TOLERANCE of the samples)
+GLuint                 g_CPUPassMismatches  = 0;       // Mismatches of the CPU passes 2 - 4 run on the GPU samples
+GLuint                 g_CPUPassMismatchBound = 0;     // Allowed mismatches of the passes 2 - 4 (ties of the fp16 samples)
+bool                   g_CPUCompareFailed   = false;   // Some frame exceeded the mismatch bound, non-zero exit code
+
 GLuint list_buf; // Index of the list buffer
 GLuint atomic_counter_buffer; // Index of the atomic counter buffer
 
-GLuint q[2] = { 0 };
-Tools::GPUTimer g_Timer[4];
+GLint               g_ListMode            = LinkedList; // Linked lists or lists compacted by the prefix sum (CSR)
+bool                g_LinkedListsAddressable = true;    // Nodes of all window pixels addressable by the NODE_INDEX_BITS of the head pointers
+bool                g_PixelNodeIndex      = false;      // Linked list node index derived from the pixel instead of the atomic counter
+bool                g_CompactNodes        = false;      // 8 byte linked list nodes in an SSBO instead of uvec4 nodes in a texture buffer
+GLuint              g_ListNodeBuffer      = 0;          // Storage of the compact nodes
+GLsizeiptr          g_ListNodeBytes       = 0;          // Size of the linked list nodes of the current format
+GLuint              g_TexelOffsetsBuffer  = 0;          // Sample counts, after the prefix sum the first sample of every light texel
+GLuint              g_TexelCursorsBuffer  = 0;          // Insertion positions of the compacted lists
+GLuint              g_SampleBuffer        = 0;          // Visibility map coordinates of the samples in the compacted lists
+std::vector<GLuint> g_PrefixSumBuffers;                 // Block sums of the prefix sum levels
+bool                g_GenerationTags      = false;      // Head pointers and shadow map tagged by the frame generation instead of cleared every frame
+GLuint              g_Generation          = 0;          // Generation of the current frame, 0 ... buffers need a full clear
+GLuint              g_FullClears          = 0;          // Full clears of the tagged buffers (recreation and generation wrap-around)
+GLint               g_GenerationsPerFrame = 1;          // Batches of light views of the frame, each builds its lists in a new generation
+GLuint64            g_FullClearTime       = 0;          // GPU time of the latest measured full clear [ns]
+bool                g_OccupancyStencil    = false;      // Shadow test only over the light texels marked as non-empty in the stencil buffer
+bool                g_ReceiverDepthTiles  = false;      // Shadow test rejects occluder fragments behind all receivers of their tile
+bool                g_SkipShadowed        = false;      // Shadow test skips the samples already in shadow in this frame
+bool                g_VertexPulling       = false;      // Shadow test pulls light space triangle records instead of running the geometry shader
+GLuint              g_TriangleBuffer      = 0;          // Light space triangle records of the vertex pulling (vertices and plane)
+GLuint              g_EmptyVertexArray    = 0;          // Vertex array of the draws without vertex attributes
+bool                g_EdgeFunctions       = false;      // Shadow rays tested by the precomputed edge functions of the triangles instead of the plane intersection
+bool                g_LoadBalancing       = false;      // Long compacted lists are split among the invocations of a compute work group
+bool                g_FusedListGeneration = false;      // Linked lists built by the visibility pass after a depth prepass instead of by pass 2
+bool                g_DepthPrepass        = false;      // Depth-only prepass, the scene is shaded only at the visible fragments (GL_EQUAL)
+bool                g_OverdrawStatistics  = false;      // Fragment shader invocations of the scene shading per covered pixel
+GLint               g_VisibilityEncoding  = VisibilityPositions; // Camera sample storage of pass 1 (eVisibilityEncoding)
+bool                g_EncodingError       = false;      // fp32 reference positions rendered along the compact encodings, misclassified shadow pixels reported
+GLuint              g_HeavyListBuffer     = 0;          // Fragments with long lists handed over by the shadow test
+bool                g_PackedShadows       = false;      // Shadow results as bits in g_ShadowBitBuffer instead of the R32UI shadow map
+GLuint              g_ShadowBitBuffer     = 0;          // Packed shadow results, a word per 8x4 pixel tile, cleared every frame
+GLint               g_NumLights           = 1;          // Shadowing lights sharing the samples (alias-free on GPU, spot light only)
+glm::vec3           g_LightPositions[MAX_LIGHTS];       // Positions of the additional lights 1 ... g_NumLights - 1 (--light), the light 0 is g_LightPosition
+GLint               g_SampleCopies        = 1;          // Copies of a sample the list nodes and compacted samples hold, the lights of a batch
+glm::mat4           g_VisibilityLightView;              // Light view of the positions stored by pass 1 (the main light)
+bool                g_PointLight          = false;      // Omnidirectional light, the cube faces share the samples (alias-free on GPU)
+GLint               g_NumCascades         = 0;          // Cascades of the directional light (alias-free on GPU), 0 ... spot light
+GLint               g_NumViews            = 1;          // Lights, cube faces or cascades of the frame sharing the samples
+GLint               g_NumLayers           = 1;          // Layers of the head pointer image and of the other light texel buffers
+GLint               g_FirstView           = 0;          // First view of the batch being built, the layers hold its views
+GLint               g_BatchLayers         = 1;          // Views of the batch being built
+bool                g_CubeFaceViews       = false;      // The views are cube faces, a sample goes only to the face of its dominant axis
+LightView           g_LightViews[MAX_VIEW_LAYERS];      // Views of the frame written by setLightViews()
+GLuint              g_LightViewBuffer     = 0;          // LightView of every view of the frame
+GLuint              g_ViewSampleBuffer    = 0;          // Samples inserted into the lists of every view (several views only)
+GLuint              g_ViewSampleCounts[MAX_VIEW_LAYERS] = {0}; // Latest view samples read back
+Tools::BufferReadback g_ViewSampleReadback;
+
+Tools::GPUTimer g_ShadowTestInvocations(GL_FRAGMENT_SHADER_INVOCATIONS_ARB); // Fragment shader invocations of the shadow test
+Tools::GPUTimer g_OccupiedTexels(GL_SAMPLES_PASSED);                         // Light texels with a non-empty list (occupancy stencil pass)
+Tools::GPUTimer g_ListSamples(GL_SAMPLES_PASSED);                            // Samples inserted into the lists (list buffer generation)
+Tools::GPUTimer g_SceneInvocations(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);      // Fragment shader invocations of the scene shading (visibility pass or standard shadow test)
+Tools::GPUTimer g_CoveredPixels(GL_SAMPLES_PASSED);                          // Pixels covered by the scene, the overdraw factor is invocations per covered pixel
+
+bool  g_AutoResolution = false; // Light grid resolution chosen by the mean list length
+float g_MeanListLength = 0.0f;  // Samples per occupied light texel
+
+// Bounds of the camera samples in the light view space, x and y on the view plane z = -1
+struct LightBounds {
+    glm::vec2 min;
+    glm::vec2 max;
+    float     max_depth;    // Largest distance of a sample from the light
+    GLuint    num_samples;
+};
+
+GLint                 g_LightFit           = FixedLightFrustum; // Light frustum fitting (eLightFit)
+LightBounds           g_LightBounds        = {};          // Latest bounds used to fit the light frustum
+GLuint                g_LightBoundsBuffer  = 0;           // Bounds reduced by light_frustum_bounds.cs
+Tools::BufferReadback g_LightBoundsReadback;              // Bounds of the previous frames
+
+// Precision loss of a compact visibility encoding against the fp32 positions of the same frame
+struct EncodingError {
+    GLuint samples;
+    GLuint misclassified;   // Pixels with a different shadow test result (CPU engine on both sample sets)
+    float  max_error;       // Largest light view space distance of a decoded sample from its reference
+    float  mean_error;
+};
+
+EncodingError         g_EncodingErrorStats = {};          // Latest error report
+
+// List statistics of one frame, layout of the ListStatistics buffer in list_statistics.cs
+struct ListLengthStatistics {
+    GLuint frame;
+    GLuint resolution;
+    GLuint counter_begin;   // Atomic counter before and after the list generation (linked lists with the node allocation)
+    GLuint counter_end;
+    GLuint max_length;
+    GLuint num_samples;
+    GLuint histogram[NUM_LIST_LENGTH_BINS];
+};
+
+bool                  g_ListStatistics         = false; // Histogram of the light texel list lengths
+std::string           g_ListStatisticsFileName;         // CSV file with a row per read back histogram, none if empty
+FILE*                 g_ListStatisticsFile     = nullptr;
+ListLengthStatistics  g_ListLengths            = {};    // Latest statistics read back
+GLuint                g_ListLengthP99          = 0;     // 99th percentile of the list length of the occupied texels
+GLuint                g_ListStatisticsBuffer   = 0;
+Tools::BufferReadback g_ListStatisticsReadback;
+GLuint                g_RayTestCounters[3]     = {0};   // Latest ray tests, visits of samples already in shadow, shadow map stores
+GLuint                g_RayTestCounterBuffer   = 0;     // Counted by the shadow test together with the list statistics
+Tools::BufferReadback g_RayTestCounterReadback;
+
+Tools::GPUProfiler g_Profiler; // GPU times of the passes, reported a few frames late to avoid pipeline stalls
 
 // TRANSFORMATIONS___________________________________________________________________________________________________________________
 
@@ -55,7 +307,8 @@ glm::mat4& g_CameraViewMatrix       = Variables::Transform.ModelView;  // Camera
 glm::mat4& g_CameraProjectionMatrix = Variables::Transform.Projection; // Camera projection transformation ~ scene projection
 glm::vec3  g_LightPosition          = glm::vec3(0.0f, 20.0f, 0.0f);    // Light orientation 
 glm::mat4  g_LightViewMatrix;                                          // Light view transformation
-glm::mat4  g_LightProjectionMatrix  = glm::frustum(-1.0f, 1.0f,-1.0f, 1.0f, 1.0f, 1000.0f);   // Light projection transformation
+glm::mat4  g_LightProjectionMatrix  = glm::frustum(-1.0f, 1.0f,-1.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR);   // Light projection transformation
+glm::mat4  g_FittedLightProjection  = glm::frustum(-1.0f, 1.0f,-1.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR);   // Light projection fitted to the samples (fitLightFrustum())
 
 
 static const GLfloat RECTANGLE[]{
@@ -110,24 +363,179 @@ void initGL();
 void drawRectangle();
 
 /// <summary>
-/// Creates head pointer image.
+/// Creates head pointer image and the light texel buffers of the compacted lists with g_NumLayers layers.
 /// </summary>
 void createHeadPointerImage();
 
+/// <summary>
+/// Layers of the light texel buffers for the views of the frame, as many as fit into MAX_LAYER_BYTES. Every light
+/// of a batch inserts the samples again, the lights are limited to the g_SampleCopies of the list storage.
+/// </summary>
+/// <param name="num_views">Lights, cube faces or cascades of the frame</param>
+/// <param name="routed">Cube faces or cascades, a sample is inserted into one view only</param>
+GLint viewLayers(GLint num_views, bool routed);
+
+/// <summary>
+/// Sorts the visibility samples into contiguous ranges of the light texels (count, prefix sum, scatter).
+/// </summary>
+/// <param name="statistics">Count the samples by the g_ListSamples query (first batch only)</param>
+void buildCompactedLists(bool statistics);
+
+/// <summary>
+/// Builds the lists of the batch of light views (g_FirstView, g_BatchLayers, g_Generation) and runs the shadow test.
+/// </summary>
+/// <param name="fused">Linked lists already built by the visibility pass</param>
+/// <param name="layered">Several views, the shadow test draws the triangles to the layers of the batch</param>
+/// <param name="statistics">Record the queries and list statistics (first batch only)</param>
+void buildListsAndShadowTest(bool fused, bool layered, bool statistics);
+
+/// <summary>
+/// View transformation of an additional light at g_LightPositions[light], it looks at the origin like the main light.
+/// </summary>
+/// <param name="light">Index of the light, 1 ... g_NumLights - 1</param>
+glm::mat4 lightViewMatrix(GLint light);
+
+/// <summary>
+/// Position of an additional light not given by --light, on a cone around the main light direction.
+/// </summary>
+/// <param name="light">Index of the light, 1 ... MAX_LIGHTS - 1</param>
+glm::vec3 defaultLightPosition(GLint light);
+
+/// <summary>
+/// View transformation of a cube face of the point light, face 0 is the main light (-z), then +z, +x, -x, +y, -y.
+/// </summary>
+/// <param name="main_view">View transformation of the main light</param>
+/// <param name="face">Index of the cube face</param>
+glm::mat4 cubeFaceViewMatrix(const glm::mat4& main_view, GLint face);
+
+/// <summary>
+/// Light transformations of a cascade of the directional light fitted to its camera distance range.
+/// </summary>
+/// <param name="cascade">Index of the cascade, 0 ... nearest to the camera</param>
+/// <param name="view">Light view transformation, the light looks along the direction from g_LightPosition to the origin</param>
+/// <param name="projection">Orthographic light projection</param>
+/// <param name="depth_range">Camera distance range of the samples of the cascade</param>
+void cascadeLightMatrices(GLint cascade, glm::mat4& view, glm::mat4& projection, glm::vec2& depth_range);
+
+/// <summary>
+/// Writes the light views of the frame to g_LightViewBuffer, the samples are stored in g_VisibilityLightView.
+/// </summary>
+/// <param name="point_light">Views are the cube faces of the point light</param>
+/// <param name="directional">Views are the cascades of the directional light</param>
+void setLightViews(bool point_light, bool directional);
+
+/// <summary>
+/// Sets the batch of light views to the bound program reading the views (g_FirstView, g_BatchLayers).
+/// </summary>
+void setViewLayers();
+
+/// <summary>
+/// Exclusive prefix sum of the buffer items computed by compute shaders.
+/// </summary>
+/// <param name="buffer">Buffer with the items, the result is written in place</param>
+/// <param name="count">Number of items</param>
+/// <param name="level">Recursion level, index of the buffer of block sums</param>
+void prefixSum(GLuint buffer, GLuint count, size_t level = 0);
+
+/// <summary>
+/// Fits the light projection to the bounds of the camera samples in the visibility map (g_FittedLightProjection).
+/// </summary>
+void fitLightFrustum();
+
+/// <summary>
+/// Doubles or halves the light grid resolution when the mean list length per occupied texel stays outside of the target band.
+/// </summary>
+void updateAutoResolution();
+
+/// <summary>
+/// Reads back the newest finished list statistics and resets the statistics of this frame, call before the list generation.
+/// </summary>
+void beginListStatistics();
+
+/// <summary>
+/// Computes the list length histogram of this frame, call after the list generation.
+/// </summary>
+void endListStatistics();
+
 /// <summary>
 /// Recreates textures that depend on the window resolution.
 /// </summary>
 /// <param name="resolution">Resolution of the window</param>
 void resizeWindow(const glm::ivec2& resolution);
 
+/// <summary>
+/// Captures object space triangles of the scene with transform feedback into g_SceneTriangleBuffer (once, the scene is static).
+/// </summary>
+void captureSceneTriangles();
+
+/// <summary>
+/// Transforms the captured scene triangles to the light view space records of g_TriangleBuffer (vertices, plane and edge functions).
+/// </summary>
+void setupLightSpaceTriangles();
+
+/// <summary>
+/// Reads back the camera samples of pass 1 as light view space positions (w is 1 for covered pixels) in any encoding.
+/// </summary>
+/// <param name="samples">Samples of the window pixels</param>
+void readVisibilityMap(std::vector<glm::vec4>& samples);
+
+/// <summary>
+/// Sets the encoding uniforms of the bound program reading the camera samples (fetchCameraSample()).
+/// </summary>
+void setVisibilityEncoding();
+
+/// <summary>
+/// Creates the CPU reference engine with the captured scene and matches its light grid rasterization to the GPU.
+/// </summary>
+void initCPUEngine();
+
+/// <summary>
+/// Sets the shadow result uniforms of the bound program writing or reading the shadow map (shadowWord() and shadowBit()).
+/// </summary>
+void setPackedShadows();
+
+/// <summary>
+/// Reads back the shadow results of the current frame in either storage.
+/// </summary>
+/// <param name="shadowed">1 for the pixels in shadow, 0 otherwise</param>
+void readShadowMap(std::vector<GLuint>& shadowed);
+
+/// <summary>
+/// Classifies the decoded samples and the fp32 reference positions by the CPU engine and compares the shadow results.
+/// </summary>
+void measureEncodingError();
+
+/// <summary>
+/// Replaces the list buffer generation and shadow test by the CPU reference engine and uploads its shadow map.
+/// </summary>
+void shadowTestCPU();
+
+/// <summary>
+/// Renders the scene depth only and sets up the depth test of the following shading pass (GL_EQUAL, no depth writes).
+/// </summary>
+/// <param name="program">Program with the vertex shader of the shading pass only (invariant position)</param>
+void depthPrepass(GLuint program);
+
+/// <summary>
+/// Counts the pixels covered by the scene in the depth buffer of the bound framebuffer and restores the default depth test.
+/// </summary>
+void countCoveredPixels();
+
+/// <summary>
+/// Releases the CPU engine and the profiler queries before the OpenGL context is destroyed.
+/// </summary>
+void releaseGL();
+
 // IMPLEMENTATION____________________________________________________________________________________________________________________
 
 void display() {
 
-    // Update camera & light transformations
+    // Update camera & light transformations (the alias-free algorithm fits the projection to the samples)
     updateLightViewMatrix();
+    g_LightProjectionMatrix = glm::frustum(-1.0f, 1.0f, -1.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR);
 
-    glQueryCounter(q[0], GL_TIMESTAMP);
+    g_Profiler.beginFrame();
+    g_Profiler.begin("Total time");
 
     if (g_ShadowMapsAlgo)
     {
@@ -138,18 +546,80 @@ void display() {
         standardShadowMapping();
     }
 
-    glQueryCounter(q[1], GL_TIMESTAMP);
+    g_Profiler.end();
+    g_Profiler.endFrame();
 
-    GLuint64 start, stop;
-    glGetQueryObjectui64v(q[0], GL_QUERY_RESULT, &start);
-    glGetQueryObjectui64v(q[1], GL_QUERY_RESULT, &stop);
-    printf("Total time [ms]: %f\n", (stop - start) / 1000000.0);
-    if (g_ShadowMapsAlgo)
+    // Latest available GPU times (nested scopes are indented)
+    const std::vector<Tools::GPUProfiler::Scope>& scopes = g_Profiler.getResults();
+    for (size_t i = 0; i < scopes.size(); i++)
+    {
+        const std::string label = std::string(2 * scopes[i].depth, ' ') + scopes[i].name + " [ms]:";
+        printf("%-48s %f\n", label.c_str(), scopes[i].time / 1000000.0);
+    }
+    if (g_OverdrawStatistics && GLEW_ARB_pipeline_statistics_query)
+    {
+        const bool   prepass = g_DepthPrepass || (g_FusedListGeneration && (g_ListMode == LinkedList) && ((g_ShadowMapsAlgo == 1) || g_CPUCompare));
+        const GLuint covered = g_CoveredPixels.get();
+        printf("Scene shading fragment invocations: %u, covered pixels: %u, overdraw %.2f (%s)\n", g_SceneInvocations.get(), covered,
+               covered ? double(g_SceneInvocations.get()) / covered : 0.0, prepass ? "depth prepass" : "no prepass");
+    }
+    if ((g_ShadowMapsAlgo != 0) && g_EncodingError && (g_VisibilityEncoding != VisibilityPositions))
+        printf("Visibility encoding error: %u of %u samples misclassified, light space error max %g, mean %g\n",
+               g_EncodingErrorStats.misclassified, g_EncodingErrorStats.samples, g_EncodingErrorStats.max_error, g_EncodingErrorStats.mean_error);
+    if ((g_ShadowMapsAlgo != 0) && g_GenerationTags)
+    {
+        // The full clear is in the results of a few frames only, its latest time is amortized over the wrap-around
+        const GLint    interval   = glm::max(GLint(MAX_GENERATION) / g_GenerationsPerFrame, 1);
+        const GLuint64 full_clear = g_Profiler.get("Full clear");
+        if (full_clear > 0)
+            g_FullClearTime = full_clear;
+        printf("Generation tags: %d generations per frame, full clear every %d frames (%u so far), %f ms, %f ms per frame\n",
+               g_GenerationsPerFrame, interval, g_FullClears, g_FullClearTime / 1000000.0, g_FullClearTime / 1000000.0 / interval);
+    }
+    if ((g_ShadowMapsAlgo == 1) || g_CPUCompare)
     {
-        printf("1. Visibility map generation [ms]: %f\n", g_Timer[0].get() / 1000000.0);
-        printf("2. List buffer generation [ms]:    %f\n", g_Timer[1].get() / 1000000.0);
-        printf("3. Shadow test [ms]:               %f\n", g_Timer[2].get() / 1000000.0);
-        printf("4. Render scene [ms]:              %f\n", g_Timer[3].get() / 1000000.0);
+        printf("3. Shadow test fragment invocations: %u\n", g_ShadowTestInvocations.get());
+        if (g_OccupancyStencil || g_AutoResolution)
+            printf("Occupied light texels: %u of %u (%.2f %%)\n", g_OccupiedTexels.get(), g_Resolution * g_Resolution,
+                   100.0 * g_OccupiedTexels.get() / (g_Resolution * g_Resolution));
+    }
+    if ((g_ShadowMapsAlgo == 1) && g_PointLight)
+    {
+        const GLuint* face_samples = g_ViewSampleCounts;
+        printf("Cube face samples -z / +z / +x / -x / +y / -y: %u / %u / %u / %u / %u / %u\n", face_samples[0], face_samples[1],
+               face_samples[2], face_samples[3], face_samples[4], face_samples[5]);
+    }
+    else if ((g_ShadowMapsAlgo == 1) && (g_NumCascades > 1))
+    {
+        printf("Cascade samples:");
+        for (GLint cascade = 0; cascade < g_NumCascades; cascade++)
+            printf(" %u", g_ViewSampleCounts[cascade]);
+        printf("\n");
+    }
+    if (g_ListStatistics && ((g_ShadowMapsAlgo == 1) || g_CPUCompare))
+    {
+        const GLuint occupied = g_ListLengths.resolution * g_ListLengths.resolution - g_ListLengths.histogram[0];
+        printf("List lengths (frame %u): %u samples, %u nodes allocated, %u occupied texels, mean %.2f, max %u, p99 %u\n",
+               g_ListLengths.frame, g_ListLengths.num_samples, g_ListLengths.counter_end - g_ListLengths.counter_begin, occupied,
+               occupied ? double(g_ListLengths.num_samples) / occupied : 0.0, g_ListLengths.max_length, g_ListLengthP99);
+        printf("Shadow test ray tests: %u, visits of shadowed samples: %u (%s), shadow map stores: %u\n", g_RayTestCounters[0],
+               g_RayTestCounters[1], g_SkipShadowed ? "skipped" : "tested", g_RayTestCounters[2]);
+    }
+    if ((g_ShadowMapsAlgo != 0) && g_AutoResolution)
+        printf("Auto resolution: %d, mean list length %.2f\n", g_Resolution, g_MeanListLength);
+    if ((g_ShadowMapsAlgo != 0) && (g_LightFit != FixedLightFrustum))
+        printf("Light frustum: [%f, %f] x [%f, %f], far %f (%u samples)\n", g_LightBounds.min.x, g_LightBounds.max.x,
+               g_LightBounds.min.y, g_LightBounds.max.y, g_LightBounds.max_depth, g_LightBounds.num_samples);
+    if (g_ShadowMapsAlgo == 2)
+    {
+        const AliasFreeCPU::Statistics& stat = g_CPUEngine->getStatistics();
+        printf("CPU (%u threads) visibility / lists / shadow test / resolve [ms]: %f / %f / %f / %f\n", g_CPUEngine->getThreadCount(),
+               stat.time[0], stat.time[1], stat.time[2], stat.time[3]);
+        printf("CPU samples %u, occupied texels %u, ray tests %llu, shadowed samples %u\n", stat.samples, stat.occupied_texels,
+               static_cast<unsigned long long>(stat.ray_tests), stat.shadowed_samples);
+        if (g_CPUCompare)
+            printf("CPU vs GPU shadow map mismatches: %u (bound %u), with the GPU samples: %u (bound %u)\n", g_CPUMismatches,
+                   g_CPUMismatchBound, g_CPUPassMismatches, g_CPUPassMismatchBound);
     }
 
 }
@@ -160,6 +630,8 @@ void standardShadowMapping()
     createVirtualFramebuffer();
 
     // DEPTH TEXTURE GENERATION -----------------------------------------------
+    g_Profiler.begin("1. Depth map generation");
+
     GLuint pid = g_ProgramId[DepthTextureGeneration];
     glUseProgram(pid);
 
@@ -178,14 +650,26 @@ void standardShadowMapping()
     //glCullFace(GL_BACK);
 
     glViewport(0, 0, Variables::WindowSize.x, Variables::WindowSize.y);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, Variables::Framebuffer);
+
+    g_Profiler.end();
 
     // SHADOW GENERATION ------------------------------------------------------
+    g_Profiler.begin("2. Render scene");
+
     pid = g_ProgramId[ShadowTest];
     glUseProgram(pid);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    if (g_DepthPrepass)
+    {
+        g_Profiler.begin("Depth prepass");
+        depthPrepass(g_ProgramId[DepthPrepassStandard]);
+        g_Profiler.end();
+        glUseProgram(pid);
+    }
+
     glBindTextures(0, 4, g_Textures);
 
     static GLuint sampler = 0;
@@ -212,9 +696,21 @@ void standardShadowMapping()
     shadowTransformMatrix = matScale * g_LightProjectionMatrix * g_LightViewMatrix;
     glUniformMatrix4fv(glGetUniformLocation(pid, "u_ShadowTransformMatrix"), 1, GL_FALSE, &shadowTransformMatrix[0][0]);
 
+    const bool overdraw_statistics = g_OverdrawStatistics && GLEW_ARB_pipeline_statistics_query;
+    if (overdraw_statistics)
+        g_SceneInvocations.start();
     Tools::DrawScene();
+    if (overdraw_statistics)
+    {
+        g_SceneInvocations.stop();
+        countCoveredPixels();
+    }
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
     glUseProgram(0);
 
+    g_Profiler.end();
+
     // Show depth maps
     if (g_ShowDepthTexture)
     {
@@ -269,6 +765,20 @@ void createVirtualFramebuffer()
 
 void aliasFreeShadowMapping()
 {
+    if (g_AutoResolution)
+        updateAutoResolution();
+
+    // The views of the lights, cube faces or cascades are built in batches of layers
+    const bool  point_light = (g_ShadowMapsAlgo == 1) && g_PointLight;
+    const bool  directional = (g_ShadowMapsAlgo == 1) && (g_NumCascades > 0) && !point_light;
+    const GLint num_lights  = ((g_ShadowMapsAlgo == 1) && !point_light && !directional) ? g_NumLights : 1;
+    const GLint num_views   = point_light ? NUM_CUBE_FACES : (directional ? g_NumCascades : num_lights);
+    g_NumViews      = num_views;
+    g_NumLayers     = viewLayers(num_views, point_light || directional);
+    g_CubeFaceViews = point_light;
+    g_FirstView     = 0;
+    g_BatchLayers   = g_NumLayers;
+
     if (g_Switch)
     {
         resizeWindow(glm::ivec2(Variables::WindowSize.x, Variables::WindowSize.y));
@@ -283,106 +793,318 @@ void aliasFreeShadowMapping()
 
     // CLEAR BUFFERS --------------------------------------------------------------
 
-    GLuint* data;
-
-    // Reset atomic counter
-    GLuint zero = 0;
-    glClearNamedBufferData(atomic_counter_buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
-
-    // Clear head pointer image
-    unsigned int clear_color0 = std::numeric_limits<unsigned int>::max();
-    glClearTexImage(g_Textures[HeadPointerImage], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &clear_color0);
-
-    // Clear shadow map
-    unsigned int clear_color1 = 0;
-    glClearTexImage(g_Textures[ShadowMap], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &clear_color1);
+    g_Profiler.begin("0. Clear buffers");
 
+    // Head pointers and shadowed texels of older generations read as empty, a full clear is needed only
+    // after the buffers were recreated and when the generation wraps around
+    // Every batch of views builds its lists in a new generation of the layers, the wrap-around comes after
+    // MAX_GENERATION / batches frames, the cost is reported by the "Full clear" scope and the generation tag statistics
+    const GLint num_batches = (num_views + g_NumLayers - 1) / g_NumLayers;
 
-    // GENERATE VISIBILITY MAP ----------------------------------------------------
+    GLuint zero = 0;
+    g_GenerationsPerFrame = num_batches;
+    if (!g_GenerationTags || (g_Generation == 0) || (g_Generation + num_batches > MAX_GENERATION))
+    {
+        g_Profiler.begin("Full clear");
+        // Reset atomic counter, it allocates the nodes modulo the list capacity until the next full clear
+        glClearNamedBufferData(atomic_counter_buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        // Clear head pointer image, shadow map and light texel occupancy (generation 0 is never used)
+        glClearTexImage(g_Textures[HeadPointerImage], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        if (!g_PackedShadows)
+            glClearTexImage(g_Textures[ShadowMap], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        const GLint stencil_zero = 0;
+        glClearNamedFramebufferiv(g_ShadowTestFramebuffer, GL_STENCIL, 0, &stencil_zero);
+        glClearTexImage(g_Textures[ReceiverDepthTiles], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glClearTexImage(g_Textures[ReceiverDepthTilesCoarse], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        g_Generation = 0;
+        g_FullClears++;
+        g_Profiler.end();
+    }
+    g_Generation++;
 
-    g_Timer[0].start();
+    // Bits cannot carry the generation, the packed shadow results and the light masks are cleared every frame
+    if (g_PackedShadows || (num_views > 1))
+    {
+        g_Profiler.begin("Shadow mask clear");
+        if (g_PackedShadows)
+            glClearNamedBufferData(g_ShadowBitBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        else
+            glClearTexImage(g_Textures[ShadowMap], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        g_Profiler.end();
+    }
 
-    GLuint pid = g_ProgramId[VisibilityMapGeneration];
-    glUseProgram(pid);
+    if (g_ListStatistics && ((g_ShadowMapsAlgo == 1) || g_CPUCompare))
+        beginListStatistics();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, g_Framebuffer);
-    GLuint attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glDrawBuffers(2, attachments);
+    if (g_ListMode == CompactedList)
+    {
+        // Reset sample counts
+        glClearNamedBufferData(g_TexelOffsetsBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
 
-    glBindTextureUnit(0, g_Textures[Diffuse]);
+    // Samples of the views, the layered shadow test skips the empty ones
+    if (g_LightViewBuffer == 0)
+    {
+        glCreateBuffers(1, &g_LightViewBuffer);
+        glNamedBufferStorage(g_LightViewBuffer, MAX_VIEW_LAYERS * sizeof(LightView), NULL, GL_DYNAMIC_STORAGE_BIT);
+        glCreateBuffers(1, &g_ViewSampleBuffer);
+        glNamedBufferStorage(g_ViewSampleBuffer, MAX_VIEW_LAYERS * sizeof(GLuint), NULL, GL_NONE);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, g_LightViewBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, g_ViewSampleBuffer);
+    if (num_views > 1)
+    {
+        g_ViewSampleReadback.read(g_ViewSampleCounts);
+        glClearNamedBufferData(g_ViewSampleBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
 
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    g_Profiler.end();
 
-    glUniformMatrix4fv(0, 1, GL_FALSE, &g_CameraViewMatrix[0][0]);
-    glUniformMatrix4fv(1, 1, GL_FALSE, &g_CameraProjectionMatrix[0][0]);
-    glUniformMatrix4fv(2, 1, GL_FALSE, &g_LightViewMatrix[0][0]);
 
-    const glm::vec4 light_position = (g_CameraViewMatrix * glm::inverse(g_LightViewMatrix)) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-    glUniform4fv(3, 1, &light_position.x);
+    // GENERATE VISIBILITY MAP ----------------------------------------------------
 
-    Tools::DrawScene();
+    // Linked lists built by the visibility pass, the light projection must be known before it (the frustum fitted
+    // to the samples of this frame is used by the next frame)
+    // The visibility buffer pass pulls the captured triangles, it does not support the fused list generation, neither
+    // do the point and directional lights (the samples are routed to the cube faces or cascades by the list buffer generation)
+    const bool gpu_lists = (g_ShadowMapsAlgo == 1) || g_CPUCompare;
+    const bool vb        = (g_VisibilityEncoding == VisibilityBuffer);
+    const bool fused     = g_FusedListGeneration && gpu_lists && (g_ListMode == LinkedList) && !vb && !point_light && !directional;
+    const bool fit       = (g_LightFit != FixedLightFrustum) && !point_light && !directional;
+    if (fit && fused)
+        g_LightProjectionMatrix = g_FittedLightProjection;
+    else if (!fit)
+        g_FittedLightProjection = g_LightProjectionMatrix;
+
+    g_Profiler.begin(fused ? "1. Visibility map & list buffer generation (fused)" : "1. Visibility map generation");
+
+    // Captured before the integer visibility buffer is bound (the capture program has no fragment shader)
+    if (vb)
+        captureSceneTriangles();
+
+    // The fp32 reference positions of the error report are written to the third attachment, the normals shaded by
+    // pass 4 with several lights to the fourth one
+    const bool reference = (g_Textures[VisibilityReference] != 0);
+    const bool normals   = (num_lights > 1);
 
-    g_Timer[0].stop();
+    glBindFramebuffer(GL_FRAMEBUFFER, g_Framebuffer);
+    GLenum attachments[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, reference ? GLenum(GL_COLOR_ATTACHMENT2) : GLenum(GL_NONE), GL_COLOR_ATTACHMENT3 };
+    glDrawBuffers(normals ? 4 : (reference ? 3 : 2), attachments);
 
-    // GENERATE LIST BUFFER -------------------------------------------------------
+    if (vb)
+    {
+        const GLuint  empty_item[4] = { 0, 0, 0, 0 };
+        const GLfloat black[4]      = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferuiv(GL_COLOR, 0, empty_item);
+        glClearBufferfv(GL_COLOR, 1, black);
+        if (reference)
+            glClearBufferfv(GL_COLOR, 2, black);
+        if (normals)
+            glClearBufferfv(GL_COLOR, 3, black);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, g_SceneTriangleBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, g_SceneAttributeBuffer);
+        glBindVertexArray(g_EmptyVertexArray);
+    }
+    else
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
-    g_Timer[1].start();
+    // Only the visible fragments are shaded (and inserted into the lists)
+    if (g_DepthPrepass || fused)
+    {
+        g_Profiler.begin("Depth prepass");
+        if (vb)
+        {
+            // Same vertex pulling as the visibility buffer pass
+            glUseProgram(g_ProgramId[VisibilityBufferPrepass]);
+            glUniformMatrix4fv(0, 1, GL_FALSE, &g_CameraViewMatrix[0][0]);
+            glUniformMatrix4fv(1, 1, GL_FALSE, &g_CameraProjectionMatrix[0][0]);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDrawArrays(GL_TRIANGLES, 0, 3 * g_NumSceneTriangles);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        else
+        {
+            depthPrepass(g_ProgramId[DepthPrepass]);
+        }
+        g_Profiler.end();
+    }
 
-    pid = g_ProgramId[ListBufferGeneration];
+    GLuint pid = g_ProgramId[vb ? VisibilityBufferGeneration : VisibilityMapGeneration];
+    if (fused)
+    {
+        if (g_CompactNodes)
+            pid = g_ProgramId[g_PixelNodeIndex ? VisibilityMapGenerationFusedCompactPixelNodes : VisibilityMapGenerationFusedCompactNodes];
+        else
+            pid = g_ProgramId[g_PixelNodeIndex ? VisibilityMapGenerationFusedPixelNodes : VisibilityMapGenerationFused];
+    }
     glUseProgram(pid);
 
-    glBindTextureUnit(1, g_Textures[VisibilityMap]);
-
-    glDisable(GL_DEPTH_TEST);
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-
-    drawRectangle();
-
-    g_Timer[1].stop();
-
-    // SHADOW TEST ----------------------------------------------------------------
-    //Tools::GPUTimer
+    glBindTextureUnit(0, g_Textures[Diffuse]);
 
-    //if (query == 0) glCreateQueries(GL_TIME_ELAPSED, 1, &query);
-    //glBeginQuery(GL_TIME_ELAPSED, query);
+    glUniformMatrix4fv(0, 1, GL_FALSE, &g_CameraViewMatrix[0][0]);
+    glUniformMatrix4fv(1, 1, GL_FALSE, &g_CameraProjectionMatrix[0][0]);
+    glUniformMatrix4fv(2, 1, GL_FALSE, &g_LightViewMatrix[0][0]);
 
+    const glm::vec4 light_position = directional ? glm::vec4(glm::mat3(g_CameraViewMatrix) * glm::normalize(g_LightPosition), 0.0f)
+                                                 : (g_CameraViewMatrix * glm::inverse(g_LightViewMatrix)) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    glUniform4fv(3, 1, &light_position.x);
+    glUniform1i(8, num_lights > 1);
+    if (!vb)
+        glUniform1i(11, g_VisibilityEncoding);
+    g_VisibilityLightView = g_LightViewMatrix;
+
+    const bool overdraw_statistics = g_OverdrawStatistics && GLEW_ARB_pipeline_statistics_query;
+    if (overdraw_statistics)
+        g_SceneInvocations.start();
+    if (fused)
+    {
+        glUniform2i(4, Variables::WindowSize.x, Variables::WindowSize.y);
+        glUniform1ui(5, g_Generation);
+        glUniform1i(6, g_ReceiverDepthTiles);
+        g_BatchLayers = std::min(g_NumLayers, num_views);
+        setLightViews(point_light, directional);
+        setViewLayers();
+
+        // With the early fragment tests the query counts the visible samples, including the few outside of the light frustum
+        g_ListSamples.start();
+        Tools::DrawScene();
+        g_ListSamples.stop();
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else if (vb)
+    {
+        glDrawArrays(GL_TRIANGLES, 0, 3 * g_NumSceneTriangles);
+        glBindVertexArray(0);
+    }
+    else
+    {
+        Tools::DrawScene();
+    }
+    if (overdraw_statistics)
+    {
+        g_SceneInvocations.stop();
+        countCoveredPixels();
+    }
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
 
-    g_Timer[2].start();
+    g_Profiler.end();
 
-    glEnable(GL_CONSERVATIVE_RASTERIZATION_NV);
+    // The visibility buffer is resolved by the light space triangles (the shadow test reuses them with the vertex pulling)
+    if (vb)
+    {
+        g_Profiler.begin("Triangle setup");
+        setupLightSpaceTriangles();
+        g_Profiler.end();
+    }
 
-    pid = g_ProgramId[ShadowTestAliasFree];
-    glUseProgram(pid);
-    glUniformMatrix4fv(1, 1, GL_FALSE, &g_LightProjectionMatrix[0][0]);
-    glUniformMatrix4fv(0, 1, GL_FALSE, &g_LightViewMatrix[0][0]);
+    // FIT LIGHT FRUSTUM ----------------------------------------------------------
 
-    glBindTextureUnit(1, g_Textures[VisibilityMap]);
-    glBindTextureUnit(2, g_Textures[HeadPointerImage]);
+    if (fit && !fused)
+    {
+        g_Profiler.begin("Light frustum fitting");
+        fitLightFrustum();
+        g_LightProjectionMatrix = g_FittedLightProjection;
+        g_Profiler.end();
+    }
 
-    glDisable(GL_CULL_FACE);
-    glBindFramebuffer(GL_FRAMEBUFFER, g_ShadowTestFramebuffer);
-    glViewport(0, 0, g_Resolution, g_Resolution);
+    if (g_EncodingError && reference)
+    {
+        g_Profiler.begin("Visibility encoding error (CPU)");
+        measureEncodingError();
+        g_Profiler.end();
+    }
 
-    Tools::DrawScene();
+    // GENERATE LIST BUFFER -------------------------------------------------------
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    // The CPU engine replaces the list buffer generation and the shadow test (GPU passes run only to compare results)
+    if (gpu_lists)
+    {
+        // The additional lights, cube faces and cascades test the same samples, each batch of them builds its lists in
+        // the layers of a new generation. The faces and cascades share the bit of the light, a sample is routed to a
+        // single one.
+        if (!fused)
+            setLightViews(point_light, directional);
+        for (g_FirstView = 0; g_FirstView < num_views; g_FirstView += g_NumLayers)
+        {
+            g_BatchLayers = std::min(g_NumLayers, num_views - g_FirstView);
+            if (g_FirstView > 0)
+            {
+                g_Profiler.begin(("Views " + std::to_string(g_FirstView) + " - " + std::to_string(g_FirstView + g_BatchLayers - 1)).c_str());
+                g_Generation++;
+                if (g_ListMode == CompactedList)
+                    glClearNamedBufferData(g_TexelOffsetsBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            }
+
+            buildListsAndShadowTest(fused && (g_FirstView == 0), num_views > 1, g_FirstView == 0);
+
+            if (g_FirstView > 0)
+                g_Profiler.end();
+        }
+        g_FirstView   = 0;
+        g_BatchLayers = g_NumLayers;
 
-    glDisable(GL_CONSERVATIVE_RASTERIZATION_NV);
+        // Samples of the views read back a few frames later (statistics only, the shadow test reads them on the GPU)
+        if (num_views > 1)
+        {
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            g_ViewSampleReadback.copy(g_ViewSampleBuffer, 0, num_views * sizeof(GLuint));
+        }
+    }
 
+    if (g_ShadowMapsAlgo == 2)
+    {
+        g_Profiler.begin("CPU shadow test (readback & upload)");
+        shadowTestCPU();
+        g_Profiler.end();
+    }
 
-    g_Timer[2].stop();
+    if (fit && fused)
+    {
+        g_Profiler.begin("Light frustum fitting");
+        fitLightFrustum();
+        g_Profiler.end();
+    }
 
 
     // RENDER SCENE ---------------------------------------------------------------
 
 
-    g_Timer[3].start();
+    g_Profiler.begin("4. Render scene");
 
     pid = g_ProgramId[RenderScene];
     glUseProgram(pid);
+    glUniform1ui(5, g_Generation);
+    setPackedShadows();
+    glUniform1ui(26, (num_views > 1) ? 1u : 0u);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // All lights are shaded in this pass, view space positions of the lights
+    glUniform1i(27, num_lights);
+    if (num_lights > 1)
+    {
+        glm::vec4 light_positions[MAX_LIGHTS];
+        for (GLint light = 0; light < num_lights; light++)
+        {
+            const glm::vec3 position = (light == 0) ? g_LightPosition : g_LightPositions[light];
+            light_positions[light] = g_CameraViewMatrix * glm::vec4(position, 1.0f);
+        }
+        const glm::mat4 inverse_projection = glm::inverse(g_CameraProjectionMatrix);
+        glUniformMatrix4fv(28, 1, GL_FALSE, &inverse_projection[0][0]);
+        glUniform4fv(32, num_lights, &light_positions[0].x);
+        glBindTextureUnit(5, g_Textures[ZBuffer]);
+        glBindTextureUnit(6, g_Textures[SceneNormals]);
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, Variables::Framebuffer);
     glViewport(0, 0, Variables::WindowSize.x, Variables::WindowSize.y);
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -390,8 +1112,7 @@ void aliasFreeShadowMapping()
 
     drawRectangle();
 
-
-    g_Timer[0].stop();
+    g_Profiler.end();
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -400,58 +1121,771 @@ void aliasFreeShadowMapping()
     if (g_ShowDepthTexture)
     {
         Tools::Texture::Show2DTexture(g_Textures[VisibilityMap], Variables::WindowSize.x - 200, Variables::WindowSize.y - 200, 200, 200);
-        Tools::Texture::Show2DTexture(g_Textures[HeadPointerImage], Variables::WindowSize.x - 200, Variables::WindowSize.y - 400, 200, 200);
-        Tools::Texture::Show2DTexture(g_Textures[ShadowMap], Variables::WindowSize.x - 200, Variables::WindowSize.y - 600, 200, 200);
+        Tools::Texture::Show2DTexture(g_Textures[HeadPointerView], Variables::WindowSize.x - 200, Variables::WindowSize.y - 400, 200, 200);
+        if (!g_PackedShadows)
+            Tools::Texture::Show2DTexture(g_Textures[ShadowMap], Variables::WindowSize.x - 200, Variables::WindowSize.y - 600, 200, 200);
         Tools::Texture::Show2DTexture(g_Textures[LightingMap], Variables::WindowSize.x - 200, Variables::WindowSize.y - 800, 200, 200);
     }
 }
 
-void createHeadPointerImage()
+void buildListsAndShadowTest(bool fused, bool layered, bool statistics)
 {
-    static GLint s_Resolution = 0;
+    const bool vb   = (g_VisibilityEncoding == VisibilityBuffer);
+    GLuint     zero = 0;
+    GLuint     pid  = 0;
 
-    if (s_Resolution == g_Resolution && g_Switch == false)
-        return;
+    // The edge planes pass through the light position, the directional light uses the ray intersection
+    const bool directional    = (g_LightViews[0].projection[3][3] != 0.0f);
+    const bool edge_functions = g_EdgeFunctions && !directional;
 
-    glDeleteTextures(1, &g_Textures[HeadPointerImage]);
-    glDeleteFramebuffers(1, &g_ShadowTestFramebuffer);
+    // The shadow test of the previous light left its framebuffer bound
+    glBindFramebuffer(GL_FRAMEBUFFER, g_Framebuffer);
+    glViewport(0, 0, Variables::WindowSize.x, Variables::WindowSize.y);
 
-    // Create head pointer texture
-    glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[HeadPointerImage]);
-    glTextureParameteri(g_Textures[HeadPointerImage], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTextureParameteri(g_Textures[HeadPointerImage], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTextureStorage2D(g_Textures[HeadPointerImage], 1, GL_R32UI, g_Resolution, g_Resolution);
-    glBindImageTexture(1, g_Textures[HeadPointerImage], 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+    if (fused)
+        g_Profiler.begin("2. List buffer generation (fused, tiles only)");
+    else
+        g_Profiler.begin((g_ListMode == CompactedList) ? "2. List buffer generation (compacted)" : (g_PixelNodeIndex ? "2. List buffer generation (linked, pixel nodes)" : "2. List buffer generation (linked)"));
 
+    glBindTextureUnit(1, g_Textures[VisibilityMap]);
+    glBindTextureUnit(4, g_Textures[VisibilityMap]);
 
-    glCreateFramebuffers(1, &g_ShadowTestFramebuffer);
-    glNamedFramebufferParameteri(g_ShadowTestFramebuffer, GL_FRAMEBUFFER_DEFAULT_WIDTH, g_Resolution);
-    glNamedFramebufferParameteri(g_ShadowTestFramebuffer, GL_FRAMEBUFFER_DEFAULT_HEIGHT, g_Resolution);
+    glDisable(GL_DEPTH_TEST);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-    s_Resolution = g_Resolution;
-}
+    if (g_ListMode == CompactedList)
+    {
+        buildCompactedLists(statistics);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else if (!fused)
+    {
+        if (g_CompactNodes)
+            pid = g_ProgramId[g_PixelNodeIndex ? ListBufferGenerationCompactPixelNodes : ListBufferGenerationCompactNodes];
+        else
+            pid = g_ProgramId[g_PixelNodeIndex ? ListBufferGenerationPixelNodes : ListBufferGeneration];
+        glUseProgram(pid);
+        glUniform1ui(5, g_Generation);
+        glUniform1i(6, g_ReceiverDepthTiles);
+        setVisibilityEncoding();
+        setViewLayers();
+
+        if (statistics)
+            g_ListSamples.start();
+        drawRectangle();
+        if (statistics)
+            g_ListSamples.stop();
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
 
-void resizeWindow(const glm::ivec2& resolution)
-{
-    if (g_ShadowMapsAlgo == 0) return;
+    if (g_ReceiverDepthTiles)
+    {
+        g_Profiler.begin("Receiver depth tiles");
 
-    glDeleteTextures(1, &g_Textures[ZBuffer]);
-    glDeleteTextures(1, &g_Textures[VisibilityMap]);
-    glDeleteTextures(3, &g_Textures[ListBuffer]);
-    glDeleteFramebuffers(1, &g_Framebuffer);
-    glDeleteBuffers(1, &list_buf);
+        const GLint num_tiles = (g_Resolution + RECEIVER_TILE_SIZE_COARSE - 1) / RECEIVER_TILE_SIZE_COARSE;
+        glUseProgram(g_ProgramId[ReceiverDepthTilesReduce]);
+        glDispatchCompute((num_tiles + 7) / 8, (num_tiles + 7) / 8, g_BatchLayers);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
-    // z buffer - faster, but it can have issues. Z coord is non lineary interpolated -> perspective alias
-    glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[ZBuffer]);
-    glTextureParameteri(g_Textures[ZBuffer], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTextureParameteri(g_Textures[ZBuffer], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTextureStorage2D(g_Textures[ZBuffer], 1, GL_DEPTH_COMPONENT32F, resolution.x, resolution.y);
+        g_Profiler.end();
+    }
 
-    // visibility map
+    if (g_ListStatistics && statistics)
+    {
+        g_Profiler.begin("List statistics");
+        endListStatistics();
+        g_Profiler.end();
+    }
+
+    g_Profiler.end();
+
+    // SHADOW TEST ----------------------------------------------------------------
+
+    g_Profiler.begin("3. Shadow test");
+
+    glDisable(GL_CULL_FACE);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_ShadowTestFramebuffer);
+    glViewport(0, 0, g_Resolution, g_Resolution);
+
+    glBindTextureUnit(1, g_Textures[VisibilityMap]);
+    glBindTextureUnit(2, g_Textures[HeadPointerImage]);
+    glBindTextureUnit(4, g_Textures[VisibilityMap]);
+
+    // The automatic resolution needs the number of occupied texels too
+    if (g_OccupancyStencil || g_AutoResolution)
+    {
+        g_Profiler.begin("Light texel occupancy (stencil)");
+
+        // Non-empty light texels get the generation as stencil value, so the stencil buffer is not cleared every frame
+        glUseProgram(g_ProgramId[(g_ListMode == CompactedList) ? LightTexelOccupancyCompacted : LightTexelOccupancy]);
+        glUniform1i(24, g_BatchLayers);
+        if (g_ListMode == CompactedList)
+            glUniform1i(2, g_Resolution);
+        else
+            glUniform1ui(5, g_Generation);
+
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_ALWAYS, g_Generation, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        if (statistics)
+            g_OccupiedTexels.start();
+        drawRectangle();
+        if (statistics)
+            g_OccupiedTexels.stop();
+
+        // Shadow test fragments over empty texels fail the early stencil test
+        glStencilFunc(GL_EQUAL, g_Generation, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        if (!g_OccupancyStencil)
+            glDisable(GL_STENCIL_TEST);
+
+        g_Profiler.end();
+    }
+
+    if (GLEW_NV_conservative_raster)
+        glEnable(GL_CONSERVATIVE_RASTERIZATION_NV);
+
+    if (g_VertexPulling && !vb && (g_FirstView == 0))
+    {
+        // Light space triangle records replace the geometry shader, all batches pull the same records
+        g_Profiler.begin("Triangle setup");
+        setupLightSpaceTriangles();
+        g_Profiler.end();
+    }
+
+    // Linked, compacted, compact nodes, compact pixel nodes, compacted with load balancing (the pulled and layered
+    // variants follow the same order). The layered vertex pulling writes gl_Layer in the vertex shader, without
+    // ARB_shader_viewport_layer_array the layered geometry shader draws the batch.
+    const eAlgorithmPass shadow_tests[5] = { ShadowTestAliasFree, ShadowTestAliasFreeCompacted, ShadowTestAliasFreeCompactNodes,
+                                             ShadowTestAliasFreeCompactPixelNodes, ShadowTestAliasFreeCompactedBalanced };
+    int variant = 0;
+    if (g_ListMode == CompactedList)
+        variant = g_LoadBalancing ? 4 : 1;
+    else if (g_CompactNodes)
+        variant = g_PixelNodeIndex ? 3 : 2;
+    const bool pulled = g_VertexPulling && (!layered || GLEW_ARB_shader_viewport_layer_array);
+    if (layered)
+        pid = g_ProgramId[(pulled ? ShadowTestAliasFreePulledLayered : ShadowTestAliasFreeLayered) + variant];
+    else
+        pid = g_ProgramId[pulled ? (ShadowTestAliasFreePulled + variant) : shadow_tests[variant]];
+    glUseProgram(pid);
+
+    // The single view is drawn by its transformations, the layered shadow test transforms the triangles in the stored
+    // light view space to every view of the batch
+    const glm::mat4& sample_to_light = g_LightViews[0].sample_to_light;
+    const glm::mat4  light_view      = (layered || (sample_to_light == glm::mat4(1.0f))) ? g_VisibilityLightView : sample_to_light * g_VisibilityLightView;
+    glUniformMatrix4fv(1, 1, GL_FALSE, &g_LightViews[0].projection[0][0]);
+    glUniformMatrix4fv(0, 1, GL_FALSE, &light_view[0][0]);
+    glUniform1i(2, g_Resolution);
+    glUniform1ui(5, g_Generation);
+    glUniform1i(6, g_ReceiverDepthTiles);
+    glUniform1i(8, g_SkipShadowed);
+    glUniform1i(9, g_ListStatistics && statistics);
+    glUniform1i(10, edge_functions);
+    glUniform1i(29, directional);
+    setVisibilityEncoding();
+    setPackedShadows();
+    setViewLayers();
+
+    if (g_ListStatistics && statistics)
+    {
+        if (g_RayTestCounterBuffer == 0)
+        {
+            glCreateBuffers(1, &g_RayTestCounterBuffer);
+            glNamedBufferStorage(g_RayTestCounterBuffer, sizeof(g_RayTestCounters), NULL, GL_NONE);
+        }
+        g_RayTestCounterReadback.read(g_RayTestCounters);
+        glClearNamedBufferData(g_RayTestCounterBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, g_RayTestCounterBuffer);
+    }
+
+    const bool load_balancing = g_LoadBalancing && (g_ListMode == CompactedList);
+    if (load_balancing)
+    {
+        // Counter padded to the 16 byte alignment of the items
+        if (g_HeavyListBuffer == 0)
+        {
+            glCreateBuffers(1, &g_HeavyListBuffer);
+            glNamedBufferStorage(g_HeavyListBuffer, 16 + HEAVY_LIST_BYTES * MAX_HEAVY_LISTS, NULL, GL_NONE);
+        }
+        glClearNamedBufferSubData(g_HeavyListBuffer, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, g_HeavyListBuffer);
+    }
+
+    if (GLEW_ARB_pipeline_statistics_query && statistics)
+        g_ShadowTestInvocations.start();
+    if (pulled)
+    {
+        // One instance per layer of the batch
+        glBindVertexArray(g_EmptyVertexArray);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 3 * g_NumSceneTriangles, layered ? g_BatchLayers : 1);
+        glBindVertexArray(0);
+    }
+    else
+    {
+        Tools::DrawScene();
+    }
+    if (GLEW_ARB_pipeline_statistics_query && statistics)
+        g_ShadowTestInvocations.stop();
+
+    // The shadow test of the next batch reads and updates the same shadow results
+    if (layered)
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glDisable(GL_STENCIL_TEST);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    if (GLEW_NV_conservative_raster)
+        glDisable(GL_CONSERVATIVE_RASTERIZATION_NV);
+
+    if (load_balancing)
+    {
+        g_Profiler.begin("Heavy lists");
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(g_ProgramId[ShadowTestHeavyLists]);
+        glUniform1ui(5, g_Generation);
+        glUniform1i(8, g_SkipShadowed);
+        glUniform1i(9, g_ListStatistics && statistics);
+        glUniform1i(10, edge_functions);
+        glUniform1i(29, directional);
+        setVisibilityEncoding();
+        setPackedShadows();
+        setViewLayers();
+        glDispatchCompute(HEAVY_LIST_WORK_GROUPS, 1, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        g_Profiler.end();
+    }
+
+    if (g_ListStatistics && statistics)
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        g_RayTestCounterReadback.copy(g_RayTestCounterBuffer, 0, sizeof(g_RayTestCounters));
+    }
+
+    g_Profiler.end();
+}
+
+glm::mat4 lightViewMatrix(GLint light)
+{
+    // Same up vector as updateLightViewMatrix(), the lights straight above or below the origin use the y axis
+    const glm::vec3& position = g_LightPositions[light];
+    const glm::vec3  up       = (glm::vec2(position) != glm::vec2(0.0f)) ? glm::normalize(glm::vec3(-position.y, position.x, 0.0f)) : glm::vec3(0.0f, 1.0f, 0.0f);
+    return glm::lookAt(position, glm::vec3(0.0f), up);
+}
+
+glm::vec3 defaultLightPosition(GLint light)
+{
+    // Tilted from the main light and turned about its direction through the origin, the golden angle keeps the
+    // lights apart for any number of them
+    const glm::vec3 direction = glm::normalize(g_LightPosition);
+    const glm::vec3 tilt_axis = glm::normalize(glm::vec3(-g_LightPosition.y, g_LightPosition.x, 0.0f));
+    const glm::mat4 rotation  = glm::rotate(glm::mat4(1.0f), LIGHT_GOLDEN_ANGLE * (light - 1), direction) *
+                                glm::rotate(glm::mat4(1.0f), ADDITIONAL_LIGHT_ANGLE, tilt_axis);
+    return glm::vec3(rotation * glm::vec4(g_LightPosition, 1.0f));
+}
+
+glm::mat4 cubeFaceViewMatrix(const glm::mat4& main_view, GLint face)
+{
+    // Rotations of the light view space turning the face direction to -z, [axis, angle in deg]
+    static const glm::vec4 rotations[NUM_CUBE_FACES] = {
+        glm::vec4(0.0f, 1.0f, 0.0f,   0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 180.0f),
+        glm::vec4(0.0f, 1.0f, 0.0f,  90.0f), glm::vec4(0.0f, 1.0f, 0.0f, -90.0f),
+        glm::vec4(1.0f, 0.0f, 0.0f, -90.0f), glm::vec4(1.0f, 0.0f, 0.0f,  90.0f)
+    };
+    return glm::rotate(glm::mat4(1.0f), rotations[face].w, glm::vec3(rotations[face])) * main_view;
+}
+
+void cascadeLightMatrices(GLint cascade, glm::mat4& view, glm::mat4& projection, glm::vec2& depth_range)
+{
+    // Camera near plane and the split distances, the farthest cascade takes also the samples beyond CASCADE_MAX_DISTANCE
+    const glm::mat4& camera_projection = g_CameraProjectionMatrix;
+    const float near = camera_projection[3][2] / (camera_projection[2][2] - 1.0f);
+    const float far  = std::min(camera_projection[3][2] / (camera_projection[2][2] + 1.0f), CASCADE_MAX_DISTANCE);
+    float split[2];
+    for (GLint i = 0; i < 2; i++)
+    {
+        const float s = float(cascade + i) / g_NumCascades;
+        split[i] = glm::mix(near + (far - near) * s, near * std::pow(far / near, s), CASCADE_SPLIT_LAMBDA);
+    }
+
+    // Bounds of the camera frustum slice in the light orientation
+    const glm::vec3 direction = -glm::normalize(g_LightPosition);
+    const glm::mat4 rotation  = glm::lookAt(glm::vec3(0.0f), direction, glm::normalize(glm::vec3(-g_LightPosition.y, g_LightPosition.x, 0.0f)));
+    const glm::mat4 camera_to_rotation = rotation * glm::inverse(g_CameraViewMatrix);
+    glm::vec3 min( std::numeric_limits<float>::max());
+    glm::vec3 max(-std::numeric_limits<float>::max());
+    for (GLint i = 0; i < 8; i++)
+    {
+        const float     d      = split[i >> 2];
+        const glm::vec4 corner = camera_to_rotation * glm::vec4(((i & 1) ? d : -d) / camera_projection[0][0], ((i & 2) ? d : -d) / camera_projection[1][1], -d, 1.0f);
+        min = glm::min(min, glm::vec3(corner));
+        max = glm::max(max, glm::vec3(corner));
+    }
+
+    // The light is in front of the slice and the near plane far behind it, the occluders toward the light are not clipped
+    const glm::vec2 extent = (glm::vec2(max) - glm::vec2(min)) * 0.5f;
+    view       = glm::translate(glm::mat4(1.0f), -glm::vec3((glm::vec2(min) + glm::vec2(max)) * 0.5f, max.z + LIGHT_NEAR)) * rotation;
+    projection = glm::ortho(-extent.x, extent.x, -extent.y, extent.y, -LIGHT_FAR, max.z - min.z + LIGHT_NEAR);
+    depth_range = glm::vec2((cascade == 0) ? 0.0f : split[0], (cascade == g_NumCascades - 1) ? std::numeric_limits<float>::max() : split[1]);
+}
+
+void setLightViews(bool point_light, bool directional)
+{
+    // Camera distance of a stored position (negated z row of the light to camera transformation)
+    const glm::mat4 light_to_camera = g_CameraViewMatrix * glm::inverse(g_VisibilityLightView);
+    const glm::vec4 depth_plane     = -glm::vec4(light_to_camera[0][2], light_to_camera[1][2], light_to_camera[2][2], light_to_camera[3][2]);
+
+    for (GLint view = 0; view < g_NumViews; view++)
+    {
+        // Even the first cascade has its own light transformations, the samples stay in the main light view
+        glm::mat4 light_view       = g_LightViewMatrix;
+        glm::mat4 light_projection = g_LightProjectionMatrix;
+        glm::vec2 depth_range      = glm::vec2(0.0f);
+        if (directional)
+        {
+            cascadeLightMatrices(view, light_view, light_projection, depth_range);
+        }
+        else if (view > 0)
+        {
+            light_view       = point_light ? cubeFaceViewMatrix(g_LightViewMatrix, view) : lightViewMatrix(view);
+            light_projection = glm::frustum(-1.0f, 1.0f, -1.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR);
+        }
+
+        // Stored positions of the main light are used as they are, the faces and cascades share the bit of the light
+        LightView& light = g_LightViews[view];
+        light.sample_to_light = (light_view == g_VisibilityLightView) ? glm::mat4(1.0f) : light_view * glm::inverse(g_VisibilityLightView);
+        light.projection      = light_projection;
+        light.depth_plane     = directional ? depth_plane : glm::vec4(0.0f);
+        light.depth_range     = depth_range;
+        light.light_bit       = (g_NumViews == 1) ? 0u : ((point_light || directional) ? 1u : (1u << view));
+        light.padding         = 0;
+    }
+    glNamedBufferSubData(g_LightViewBuffer, 0, g_NumViews * sizeof(LightView), g_LightViews);
+}
+
+void setViewLayers()
+{
+    glUniform1i(23, g_FirstView);
+    glUniform1i(24, g_BatchLayers);
+    glUniform1i(25, g_CubeFaceViews);
+    glUniform1i(30, g_NumViews);
+}
+
+GLint viewLayers(GLint num_views, bool routed)
+{
+    // Head pointer, stencil, texel offsets and cursors of every light texel and the receiver depth tiles
+    const GLsizeiptr texels      = GLsizeiptr(g_Resolution) * g_Resolution;
+    const GLsizeiptr layer_bytes = texels * (3 * sizeof(GLuint) + 1) + texels / (RECEIVER_TILE_SIZE * RECEIVER_TILE_SIZE) * sizeof(GLuint);
+    const GLint      max_layers  = routed ? num_views : std::min(num_views, g_SampleCopies);
+    return GLint(glm::clamp(MAX_LAYER_BYTES / layer_bytes, GLsizeiptr(1), GLsizeiptr(max_layers)));
+}
+
+void createHeadPointerImage()
+{
+    static GLint s_Resolution = 0;
+    static GLint s_Layers     = 0;
+
+    if (s_Resolution == g_Resolution && s_Layers == g_NumLayers && g_Switch == false)
+        return;
+
+    glDeleteTextures(1, &g_Textures[HeadPointerImage]);
+    glDeleteTextures(1, &g_Textures[HeadPointerView]);
+    glDeleteTextures(1, &g_Textures[OccupancyStencil]);
+    glDeleteFramebuffers(1, &g_ShadowTestFramebuffer);
+
+    // Create head pointer texture, a layer per light view of the batch
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &g_Textures[HeadPointerImage]);
+    glTextureParameteri(g_Textures[HeadPointerImage], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(g_Textures[HeadPointerImage], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureStorage3D(g_Textures[HeadPointerImage], 1, GL_R32UI, g_Resolution, g_Resolution, g_NumLayers);
+    glBindImageTexture(1, g_Textures[HeadPointerImage], 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+    g_Generation = 0;
+
+    // The first layer is shown as 2D texture
+    glGenTextures(1, &g_Textures[HeadPointerView]);
+    glTextureView(g_Textures[HeadPointerView], GL_TEXTURE_2D, g_Textures[HeadPointerImage], GL_R32UI, 0, 1, 0, 1);
+    glTextureParameteri(g_Textures[HeadPointerView], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(g_Textures[HeadPointerView], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+
+    glCreateFramebuffers(1, &g_ShadowTestFramebuffer);
+    glNamedFramebufferParameteri(g_ShadowTestFramebuffer, GL_FRAMEBUFFER_DEFAULT_WIDTH, g_Resolution);
+    glNamedFramebufferParameteri(g_ShadowTestFramebuffer, GL_FRAMEBUFFER_DEFAULT_HEIGHT, g_Resolution);
+
+    // Stencil buffer marking the non-empty light texels, attached with all layers
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &g_Textures[OccupancyStencil]);
+    glTextureStorage3D(g_Textures[OccupancyStencil], 1, GL_STENCIL_INDEX8, g_Resolution, g_Resolution, g_NumLayers);
+    glNamedFramebufferTexture(g_ShadowTestFramebuffer, GL_STENCIL_ATTACHMENT, g_Textures[OccupancyStencil], 0);
+
+    // Maximum light distance of the receivers in the light texel tiles
+    glDeleteTextures(2, &g_Textures[ReceiverDepthTiles]);
+    const GLint tile_sizes[2] = { RECEIVER_TILE_SIZE, RECEIVER_TILE_SIZE_COARSE };
+    for (int i = 0; i < 2; i++)
+    {
+        const GLint num_tiles = (g_Resolution + tile_sizes[i] - 1) / tile_sizes[i];
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &g_Textures[ReceiverDepthTiles + i]);
+        glTextureParameteri(g_Textures[ReceiverDepthTiles + i], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(g_Textures[ReceiverDepthTiles + i], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureStorage3D(g_Textures[ReceiverDepthTiles + i], 1, GL_R32UI, num_tiles, num_tiles, g_NumLayers);
+        glBindImageTexture(5 + i, g_Textures[ReceiverDepthTiles + i], 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+    }
+
+    // Light texel buffers of the compacted lists, one extra item holds the total number of samples after the prefix sum
+    glDeleteBuffers(1, &g_TexelOffsetsBuffer);
+    glDeleteBuffers(1, &g_TexelCursorsBuffer);
+    glDeleteBuffers(GLsizei(g_PrefixSumBuffers.size()), g_PrefixSumBuffers.data());
+    g_PrefixSumBuffers.clear();
+
+    const GLuint num_texels = GLuint(g_Resolution * g_Resolution * g_NumLayers) + 1;
+    glCreateBuffers(1, &g_TexelOffsetsBuffer);
+    glNamedBufferStorage(g_TexelOffsetsBuffer, num_texels * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &g_TexelCursorsBuffer);
+    glNamedBufferStorage(g_TexelCursorsBuffer, num_texels * sizeof(GLuint), NULL, GL_NONE);
+
+    // Block sums of all levels of the prefix sum, the last level has a single block
+    GLuint num_blocks = num_texels;
+    do
+    {
+        num_blocks = (num_blocks + PREFIX_SUM_BLOCK_SIZE - 1) / PREFIX_SUM_BLOCK_SIZE;
+        GLuint buffer = 0;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, num_blocks * sizeof(GLuint), NULL, GL_NONE);
+        g_PrefixSumBuffers.push_back(buffer);
+    } while (num_blocks > 1);
+
+    s_Resolution = g_Resolution;
+    s_Layers     = g_NumLayers;
+}
+
+void buildCompactedLists(bool statistics)
+{
+    // Light texels of the layers of the batch
+    const GLuint num_texels = GLuint(g_Resolution * g_Resolution * g_BatchLayers) + 1;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_TexelOffsetsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_TexelCursorsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g_SampleBuffer);
+
+    // Count samples of every light texel
+    glUseProgram(g_ProgramId[CompactedListCount]);
+    glUniform1i(0, g_Resolution);
+    glUniform1ui(5, g_Generation);
+    glUniform1i(6, g_ReceiverDepthTiles);
+    setVisibilityEncoding();
+    setViewLayers();
+    if (statistics)
+        g_ListSamples.start();
+    drawRectangle();
+    if (statistics)
+        g_ListSamples.stop();
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Counts -> offsets
+    prefixSum(g_TexelOffsetsBuffer, num_texels);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    glCopyNamedBufferSubData(g_TexelOffsetsBuffer, g_TexelCursorsBuffer, 0, 0, num_texels * sizeof(GLuint));
+
+    // Scatter samples into the ranges of their light texels
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_TexelOffsetsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_TexelCursorsBuffer);
+    glUseProgram(g_ProgramId[CompactedListScatter]);
+    glUniform1i(0, g_Resolution);
+    setVisibilityEncoding();
+    setViewLayers();
+    drawRectangle();
+}
+
+void prefixSum(GLuint buffer, GLuint count, size_t level)
+{
+    const GLuint num_blocks = (count + PREFIX_SUM_BLOCK_SIZE - 1) / PREFIX_SUM_BLOCK_SIZE;
+
+    // Scan every block and store the block totals
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_PrefixSumBuffers[level]);
+    glUseProgram(g_ProgramId[PrefixSumBlocks]);
+    glUniform1ui(0, count);
+    glDispatchCompute(num_blocks, 1, 1);
+
+    if (num_blocks > 1)
+    {
+        // Scan the block totals and add them to the blocks
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        prefixSum(g_PrefixSumBuffers[level], num_blocks, level + 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_PrefixSumBuffers[level]);
+        glUseProgram(g_ProgramId[PrefixSumAdd]);
+        glUniform1ui(0, count);
+        glDispatchCompute(num_blocks, 1, 1);
+    }
+}
+
+void fitLightFrustum()
+{
+    if (g_LightFit == GPULightFit)
+    {
+        // Order preserving uint encoding of the floats in light_frustum_bounds.cs
+        auto decode = [](GLuint bits) {
+            bits = (bits & 0x80000000u) ? (bits & 0x7FFFFFFFu) : ~bits;
+            float value = 0.0f;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        };
+
+        if (g_LightBoundsBuffer == 0)
+        {
+            glCreateBuffers(1, &g_LightBoundsBuffer);
+            glNamedBufferStorage(g_LightBoundsBuffer, 6 * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+        }
+
+        // Newest finished readback, the bounds are a few frames old but reading them never stalls the pipeline
+        GLuint bounds[6];
+        if (g_LightBoundsReadback.read(bounds))
+        {
+            g_LightBounds.min         = glm::vec2(decode(bounds[0]), decode(bounds[1]));
+            g_LightBounds.max         = -glm::vec2(decode(bounds[2]), decode(bounds[3]));
+            g_LightBounds.max_depth   = decode(bounds[4]);
+            g_LightBounds.num_samples = bounds[5];
+        }
+
+        // Reduce the bounds of this frame
+        const GLuint initial_bounds[6] = { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0, 0 };
+        glNamedBufferSubData(g_LightBoundsBuffer, 0, sizeof(initial_bounds), initial_bounds);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, g_LightBoundsBuffer);
+        glBindTextureUnit(1, g_Textures[VisibilityMap]);
+        glBindTextureUnit(4, g_Textures[VisibilityMap]);
+        glUseProgram(g_ProgramId[LightFrustumBounds]);
+        setVisibilityEncoding();
+        glDispatchCompute((Variables::WindowSize.x + 15) / 16, (Variables::WindowSize.y + 15) / 16, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        g_LightBoundsReadback.copy(g_LightBoundsBuffer, 0, sizeof(initial_bounds));
+    }
+    else
+    {
+        // CPU fallback, the visibility map of this frame is read back
+        const GLsizei num_pixels = Variables::WindowSize.x * Variables::WindowSize.y;
+        std::vector<glm::vec4> samples;
+        readVisibilityMap(samples);
+
+        g_LightBounds.min         = glm::vec2(std::numeric_limits<float>::max());
+        g_LightBounds.max         = glm::vec2(-std::numeric_limits<float>::max());
+        g_LightBounds.max_depth   = 0.0f;
+        g_LightBounds.num_samples = 0;
+        for (GLsizei i = 0; i < num_pixels; i++)
+        {
+            const glm::vec4& sample = samples[i];
+            if ((sample.w != 1.0f) || (sample.z >= 0.0f))
+                continue;
+            const glm::vec2 plane_pos = glm::vec2(sample) / -sample.z;
+            g_LightBounds.min         = glm::min(g_LightBounds.min, plane_pos);
+            g_LightBounds.max         = glm::max(g_LightBounds.max, plane_pos);
+            g_LightBounds.max_depth   = glm::max(g_LightBounds.max_depth, -sample.z);
+            g_LightBounds.num_samples++;
+        }
+    }
+
+    g_FittedLightProjection = glm::frustum(-1.0f, 1.0f, -1.0f, 1.0f, LIGHT_NEAR, LIGHT_FAR);
+    if (g_LightBounds.num_samples == 0)
+        return;
+
+    // Inside of the fixed frustum, expanded by a texel (samples on the boundary) and by the margin of the GPU latency
+    const glm::vec2 extent = g_LightBounds.max - g_LightBounds.min;
+    const glm::vec2 margin = extent * (((g_LightFit == GPULightFit) ? LIGHT_FIT_MARGIN : 0.0f) + 1.0f / g_Resolution);
+    const glm::vec2 min    = glm::max(g_LightBounds.min - margin, glm::vec2(-1.0f));
+    const glm::vec2 max    = glm::min(g_LightBounds.max + margin, glm::vec2(1.0f));
+    const float     far    = glm::clamp(g_LightBounds.max_depth * (1.0f + LIGHT_FIT_MARGIN), 2.0f * LIGHT_NEAR, LIGHT_FAR);
+    if ((min.x < max.x) && (min.y < max.y))
+        g_FittedLightProjection = glm::frustum(min.x * LIGHT_NEAR, max.x * LIGHT_NEAR, min.y * LIGHT_NEAR, max.y * LIGHT_NEAR, LIGHT_NEAR, far);
+}
+
+void beginListStatistics()
+{
+    if (g_ListStatisticsBuffer == 0)
+    {
+        glCreateBuffers(1, &g_ListStatisticsBuffer);
+        glNamedBufferStorage(g_ListStatisticsBuffer, sizeof(ListLengthStatistics), NULL, GL_DYNAMIC_STORAGE_BIT);
+    }
+
+    // Newest finished statistics, a few frames old
+    ListLengthStatistics stat;
+    if (g_ListStatisticsReadback.read(&stat))
+    {
+        g_ListLengths = stat;
+
+        // Percentile over the occupied texels only (bin 0 are the empty ones)
+        const GLuint occupied = stat.resolution * stat.resolution - stat.histogram[0];
+        GLuint count = 0;
+        g_ListLengthP99 = 0;
+        for (GLuint i = 1; (i < NUM_LIST_LENGTH_BINS) && (count < 0.99 * occupied); i++)
+        {
+            count += stat.histogram[i];
+            g_ListLengthP99 = i;
+        }
+
+        if (!g_ListStatisticsFileName.empty() && !g_ListStatisticsFile)
+        {
+            g_ListStatisticsFile = fopen(g_ListStatisticsFileName.c_str(), "w");
+            if (!g_ListStatisticsFile)
+            {
+                printf("Cannot open list statistics file %s\n", g_ListStatisticsFileName.c_str());
+                g_ListStatisticsFileName.clear();
+            }
+            else
+            {
+                fprintf(g_ListStatisticsFile, "frame,resolution,samples,allocated_nodes,occupied_texels,max_length,p99_length");
+                for (GLuint i = 0; i < NUM_LIST_LENGTH_BINS; i++)
+                    fprintf(g_ListStatisticsFile, ",length_%u", i);
+                fprintf(g_ListStatisticsFile, "\n");
+            }
+        }
+        if (g_ListStatisticsFile)
+        {
+            fprintf(g_ListStatisticsFile, "%u,%u,%u,%u,%u,%u,%u", stat.frame, stat.resolution, stat.num_samples,
+                    stat.counter_end - stat.counter_begin, occupied, stat.max_length, g_ListLengthP99);
+            for (GLuint i = 0; i < NUM_LIST_LENGTH_BINS; i++)
+                fprintf(g_ListStatisticsFile, ",%u", stat.histogram[i]);
+            fprintf(g_ListStatisticsFile, "\n");
+        }
+    }
+
+    // The atomic counter keeps running across the generations, the allocated nodes are the difference of two copies
+    ListLengthStatistics initial_stat = {};
+    initial_stat.frame      = GLuint(Statistic::Frame::ID);
+    initial_stat.resolution = GLuint(g_Resolution);
+    glNamedBufferSubData(g_ListStatisticsBuffer, 0, sizeof(initial_stat), &initial_stat);
+    if ((g_ListMode == LinkedList) && !g_PixelNodeIndex)
+        glCopyNamedBufferSubData(atomic_counter_buffer, g_ListStatisticsBuffer, 0, offsetof(ListLengthStatistics, counter_begin), sizeof(GLuint));
+}
+
+void endListStatistics()
+{
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    if ((g_ListMode == LinkedList) && !g_PixelNodeIndex)
+        glCopyNamedBufferSubData(atomic_counter_buffer, g_ListStatisticsBuffer, 0, offsetof(ListLengthStatistics, counter_end), sizeof(GLuint));
+
+    if (g_ListMode == CompactedList)
+    {
+        glUseProgram(g_ProgramId[ListStatisticsCompacted]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_TexelOffsetsBuffer);
+    }
+    else
+    {
+        if (g_CompactNodes)
+            glUseProgram(g_ProgramId[g_PixelNodeIndex ? ListStatisticsCompactPixelNodes : ListStatisticsCompactNodes]);
+        else
+            glUseProgram(g_ProgramId[ListStatistics]);
+        glUniform1ui(5, g_Generation);
+        glBindTextureUnit(2, g_Textures[HeadPointerImage]);
+    }
+    glUniform1i(2, g_Resolution);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, g_ListStatisticsBuffer);
+    glDispatchCompute((g_Resolution + 15) / 16, (g_Resolution + 15) / 16, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    g_ListStatisticsReadback.copy(g_ListStatisticsBuffer, 0, sizeof(ListLengthStatistics));
+}
+
+void updateAutoResolution()
+{
+    static int s_Direction = 0;  // Side of the band the mean list length was on in the previous frames (+1 above, -1 below)
+    static int s_Frames    = 0;  // Number of these frames
+    static int s_Cooldown  = 0;
+
+    // Statistics of the CPU engine when the GPU lists are not built
+    GLuint samples = 0, occupied = 0;
+    if ((g_ShadowMapsAlgo == 2) && !g_CPUCompare)
+    {
+        if (!g_CPUEngine)
+            return;
+        samples  = g_CPUEngine->getStatistics().samples;
+        occupied = g_CPUEngine->getStatistics().occupied_texels;
+    }
+    else
+    {
+        // The occupancy is counted for all layers of the first batch
+        samples  = g_ListSamples.get();
+        occupied = g_OccupiedTexels.get();
+    }
+    if (occupied == 0)
+        return;
+    g_MeanListLength = float(samples) / occupied;
+
+    if (s_Cooldown > 0)
+    {
+        s_Cooldown--;
+        return;
+    }
+
+    int direction = 0;
+    if ((g_MeanListLength > AUTO_RESOLUTION_MAX_LIST) && (g_Resolution < AUTO_RESOLUTION_MAX))
+        direction = 1;
+    else if ((g_MeanListLength < AUTO_RESOLUTION_MIN_LIST) && (g_Resolution > AUTO_RESOLUTION_MIN))
+        direction = -1;
+
+    s_Frames    = (direction == s_Direction) ? s_Frames + 1 : 1;
+    s_Direction = direction;
+    if ((direction != 0) && (s_Frames >= AUTO_RESOLUTION_FRAMES))
+    {
+        // createHeadPointerImage() reallocates the light grid buffers
+        g_Resolution = (direction > 0) ? (g_Resolution << 1) : (g_Resolution >> 1);
+        s_Frames     = 0;
+        s_Cooldown   = AUTO_RESOLUTION_COOLDOWN;
+    }
+}
+
+void resizeWindow(const glm::ivec2& resolution)
+{
+    if (g_ShadowMapsAlgo == 0) return;
+
+    glDeleteTextures(1, &g_Textures[ZBuffer]);
+    glDeleteTextures(1, &g_Textures[VisibilityMap]);
+    glDeleteTextures(1, &g_Textures[VisibilityReference]);
+    glDeleteTextures(1, &g_Textures[SceneNormals]);
+    g_Textures[VisibilityReference] = g_Textures[SceneNormals] = 0;
+    glDeleteTextures(3, &g_Textures[ListBuffer]);
+    glDeleteFramebuffers(1, &g_Framebuffer);
+    glDeleteBuffers(1, &list_buf);
+    glDeleteBuffers(1, &g_ListNodeBuffer);
+    glDeleteBuffers(1, &g_SampleBuffer);
+    g_Textures[ListBuffer] = g_Textures[ShadowMap] = list_buf = g_ListNodeBuffer = 0;
+
+    // z buffer - faster, but it can have issues. Z coord is non lineary interpolated -> perspective alias
+    glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[ZBuffer]);
+    glTextureParameteri(g_Textures[ZBuffer], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(g_Textures[ZBuffer], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureStorage2D(g_Textures[ZBuffer], 1, GL_DEPTH_COMPONENT32F, resolution.x, resolution.y);
+
+    // visibility map
     glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[VisibilityMap]);
     glTextureParameteri(g_Textures[VisibilityMap], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTextureParameteri(g_Textures[VisibilityMap], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTextureStorage2D(g_Textures[VisibilityMap], 1, GL_RGBA32F, resolution.x, resolution.y);
+    const GLenum visibility_formats[NumVisibilityEncodings] = { GL_RGBA32F, GL_RG32UI, GL_RGBA16F, GL_R32F };
+    const GLuint visibility_bytes[NumVisibilityEncodings]   = { 16, 8, 8, 4 };
+    glTextureStorage2D(g_Textures[VisibilityMap], 1, visibility_formats[g_VisibilityEncoding], resolution.x, resolution.y);
+    const double megapixels = double(resolution.x) * resolution.y / 1048576.0;
+    printf("Visibility map [MB]: %.2f (positions %.2f, visibility buffer %.2f, fp16 positions %.2f, depth %.2f)\n",
+           megapixels * visibility_bytes[g_VisibilityEncoding], megapixels * visibility_bytes[VisibilityPositions],
+           megapixels * visibility_bytes[VisibilityBuffer], megapixels * visibility_bytes[VisibilityHalf], megapixels * visibility_bytes[VisibilityDepth]);
+
+    // Normals of the shading of several lights in pass 4
+    if (g_NumLights > 1)
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[SceneNormals]);
+        glTextureParameteri(g_Textures[SceneNormals], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(g_Textures[SceneNormals], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureStorage2D(g_Textures[SceneNormals], 1, GL_RGBA16F, resolution.x, resolution.y);
+    }
+
+    // fp32 positions of the error report of the compact encodings
+    if (g_EncodingError && (g_VisibilityEncoding != VisibilityPositions))
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[VisibilityReference]);
+        glTextureStorage2D(g_Textures[VisibilityReference], 1, GL_RGBA32F, resolution.x, resolution.y);
+    }
 
     // lighting map
     glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[LightingMap]);
@@ -460,27 +1894,92 @@ void resizeWindow(const glm::ivec2& resolution)
     glTextureStorage2D(g_Textures[LightingMap], 1, GL_RGBA8, resolution.x, resolution.y);
     glBindImageTexture(4, g_Textures[LightingMap], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
 
-    // Create the linked list storage buffer
-    glCreateBuffers(1, &list_buf);
-    glNamedBufferStorage(list_buf, resolution.x * resolution.y * sizeof(glm::uvec4), NULL, GL_NONE);
-
-    // Bind it to a texture (for use as a TBO)
-    glCreateTextures(GL_TEXTURE_BUFFER, 1, &g_Textures[ListBuffer]);
-    glTextureBuffer(g_Textures[ListBuffer], GL_RGBA32UI, list_buf);
-    glBindImageTexture(2, g_Textures[ListBuffer], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+    // Create the linked list storage buffer, one node per pixel
+    const GLsizeiptr num_pixels = GLsizeiptr(resolution.x) * resolution.y;
+    // Larger node indices would spill into the generation bits of the head pointers, the compacted lists have none
+    g_LinkedListsAddressable = (num_pixels <= (GLsizeiptr(1) << NODE_INDEX_BITS));
+    if (!g_LinkedListsAddressable && (g_ListMode == LinkedList))
+    {
+        printf("Window exceeds %u linked list nodes addressable by the head pointers, using compacted lists\n", 1u << NODE_INDEX_BITS);
+        g_ListMode = CompactedList;
+    }
 
-    // Create shadow map
-    glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[ShadowMap]);
-    glTextureParameteri(g_Textures[ShadowMap], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTextureParameteri(g_Textures[ShadowMap], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTextureStorage2D(g_Textures[ShadowMap], 1, GL_R32UI, resolution.x, resolution.y);
-    glBindImageTexture(3, g_Textures[ShadowMap], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    // Every light of a batch inserts the samples again, the nodes and the compacted samples hold a copy per light
+    // as long as the node indices stay addressable and the nodes fit into MAX_LAYER_BYTES, the other lights are
+    // built in the next batches (viewLayers())
+    const GLsizeiptr pixel_node_bytes = g_CompactNodes ? (g_PixelNodeIndex ? sizeof(GLuint) : sizeof(glm::uvec2)) : sizeof(glm::uvec4);
+    const GLsizeiptr max_copies       = std::min((GLsizeiptr(1) << NODE_INDEX_BITS) / num_pixels, MAX_LAYER_BYTES / (num_pixels * pixel_node_bytes));
+    g_SampleCopies = GLint(glm::clamp(max_copies, GLsizeiptr(1), GLsizeiptr(g_NumLights)));
+    if (g_SampleCopies < g_NumLights)
+        printf("List nodes hold the samples of %d of the %d lights, the lights are built in %d batches\n", g_SampleCopies, g_NumLights,
+               (g_NumLights + g_SampleCopies - 1) / g_SampleCopies);
+
+    if (g_CompactNodes)
+    {
+        // Only the pointer to the next node is needed if the node index is the pixel index
+        g_ListNodeBytes = num_pixels * g_SampleCopies * pixel_node_bytes;
+        glCreateBuffers(1, &g_ListNodeBuffer);
+        glNamedBufferStorage(g_ListNodeBuffer, g_ListNodeBytes, NULL, GL_NONE);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_ListNodeBuffer);
+
+        // The shadow test reads the nodes through a buffer image (an SSBO in the traversal loop is very slow on Mesa llvmpipe)
+        const GLenum format = g_PixelNodeIndex ? GL_R32UI : GL_RG32UI;
+        glCreateTextures(GL_TEXTURE_BUFFER, 1, &g_Textures[ListBuffer]);
+        glTextureBuffer(g_Textures[ListBuffer], format, g_ListNodeBuffer);
+        glBindImageTexture(2, g_Textures[ListBuffer], 0, GL_FALSE, 0, GL_READ_ONLY, format);
+    }
+    else
+    {
+        g_ListNodeBytes = num_pixels * g_SampleCopies * pixel_node_bytes;
+        glCreateBuffers(1, &list_buf);
+        glNamedBufferStorage(list_buf, g_ListNodeBytes, NULL, GL_NONE);
+
+        // Bind it to a texture (for use as a TBO)
+        glCreateTextures(GL_TEXTURE_BUFFER, 1, &g_Textures[ListBuffer]);
+        glTextureBuffer(g_Textures[ListBuffer], GL_RGBA32UI, list_buf);
+        glBindImageTexture(2, g_Textures[ListBuffer], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32UI);
+    }
+    printf("List nodes [MB]: %.2f (%d sample copies, per copy uvec4 nodes %.2f, compact nodes %.2f, compact pixel nodes %.2f)\n",
+           g_ListNodeBytes / 1048576.0, g_SampleCopies, num_pixels * sizeof(glm::uvec4) / 1048576.0, num_pixels * sizeof(glm::uvec2) / 1048576.0,
+           num_pixels * sizeof(GLuint) / 1048576.0);
+
+    // Samples of the compacted lists
+    glCreateBuffers(1, &g_SampleBuffer);
+    glNamedBufferStorage(g_SampleBuffer, num_pixels * g_SampleCopies * sizeof(GLuint), NULL, GL_NONE);
+
+    // Create shadow map, or the packed shadow results (the bits are cleared every frame, the first frame needs no full clear),
+    // several lights have a bit plane each
+    const GLsizeiptr shadow_words = GLsizeiptr((resolution.x + SHADOW_TILE_WIDTH - 1) / SHADOW_TILE_WIDTH) * ((resolution.y + SHADOW_TILE_HEIGHT - 1) / SHADOW_TILE_HEIGHT);
+    glDeleteBuffers(1, &g_ShadowBitBuffer);
+    g_ShadowBitBuffer = 0;
+    if (g_PackedShadows)
+    {
+        glCreateBuffers(1, &g_ShadowBitBuffer);
+        glNamedBufferStorage(g_ShadowBitBuffer, shadow_words * g_NumLights * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, g_ShadowBitBuffer);
+    }
+    else
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &g_Textures[ShadowMap]);
+        glTextureParameteri(g_Textures[ShadowMap], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(g_Textures[ShadowMap], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureStorage2D(g_Textures[ShadowMap], 1, GL_R32UI, resolution.x, resolution.y);
+        glBindImageTexture(3, g_Textures[ShadowMap], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    }
+    printf("Shadow results [MB]: %.2f (shadow map %.2f, packed %.2f per light)\n",
+           (g_PackedShadows ? shadow_words * g_NumLights * sizeof(GLuint) : num_pixels * sizeof(GLuint)) / 1048576.0,
+           num_pixels * sizeof(GLuint) / 1048576.0, shadow_words * sizeof(GLuint) / 1048576.0);
+    g_Generation = 0;
 
     // Create framebuffer
     glCreateFramebuffers(1, &g_Framebuffer);
     glNamedFramebufferTexture(g_Framebuffer, GL_DEPTH_ATTACHMENT, g_Textures[ZBuffer], 0);
     glNamedFramebufferTexture(g_Framebuffer, GL_COLOR_ATTACHMENT0, g_Textures[VisibilityMap], 0);
     glNamedFramebufferTexture(g_Framebuffer, GL_COLOR_ATTACHMENT1, g_Textures[LightingMap], 0);
+    if (g_Textures[VisibilityReference] != 0)
+        glNamedFramebufferTexture(g_Framebuffer, GL_COLOR_ATTACHMENT2, g_Textures[VisibilityReference], 0);
+    if (g_Textures[SceneNormals] != 0)
+        glNamedFramebufferTexture(g_Framebuffer, GL_COLOR_ATTACHMENT3, g_Textures[SceneNormals], 0);
 
     // Check framebuffer status
     if (g_Framebuffer > 0)
@@ -495,6 +1994,390 @@ void resizeWindow(const glm::ivec2& resolution)
     }
 }
 
+void captureSceneTriangles()
+{
+    if (g_SceneTriangleBuffer != 0)
+        return;
+
+    static GLuint s_Query = 0;
+    if (s_Query == 0)
+        glCreateQueries(GL_PRIMITIVES_GENERATED, 1, &s_Query);
+
+    glUseProgram(g_ProgramId[SceneCapture]);
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    // Count triangles first to size the transform feedback buffer
+    GLuint num_triangles = 0;
+    glBeginQuery(GL_PRIMITIVES_GENERATED, s_Query);
+    Tools::DrawScene();
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glGetQueryObjectuiv(s_Query, GL_QUERY_RESULT, &num_triangles);
+
+    // An empty scene still gets a buffer, it is captured only once
+    glCreateBuffers(1, &g_SceneTriangleBuffer);
+    glNamedBufferStorage(g_SceneTriangleBuffer, glm::max(num_triangles, 1u) * 3 * sizeof(glm::vec3), nullptr, GL_NONE);
+    glCreateBuffers(1, &g_SceneAttributeBuffer);
+    glNamedBufferStorage(g_SceneAttributeBuffer, glm::max(num_triangles, 1u) * 3 * (sizeof(glm::vec3) + sizeof(glm::vec2)), nullptr, GL_NONE);
+    glCreateVertexArrays(1, &g_EmptyVertexArray);
+    g_NumSceneTriangles = num_triangles;
+    if (num_triangles > 0)
+    {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, g_SceneTriangleBuffer);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, g_SceneAttributeBuffer);
+
+        glBeginTransformFeedback(GL_TRIANGLES);
+        Tools::DrawScene();
+        glEndTransformFeedback();
+
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, 0);
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    glUseProgram(0);
+}
+
+void setupLightSpaceTriangles()
+{
+    captureSceneTriangles();
+    if (g_TriangleBuffer == 0)
+    {
+        // Light space triangle record of the vertex pulling (struct Triangle in alias_free_common.glsl), the std430
+        // stride of the record array is taken from the program writing it
+        const GLenum stride_property = GL_TOP_LEVEL_ARRAY_STRIDE;
+        const GLuint variable = glGetProgramResourceIndex(g_ProgramId[TriangleSetup], GL_BUFFER_VARIABLE, "triangles[0].triangle_vertices[0]");
+        GLint record_bytes = 0;
+        glGetProgramResourceiv(g_ProgramId[TriangleSetup], GL_BUFFER_VARIABLE, variable, 1, &stride_property, 1, NULL, &record_bytes);
+
+        glCreateBuffers(1, &g_TriangleBuffer);
+        glNamedBufferStorage(g_TriangleBuffer, glm::max(g_NumSceneTriangles, 1u) * GLuint(record_bytes), NULL, GL_NONE);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, g_TriangleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, g_SceneTriangleBuffer);
+    glUseProgram(g_ProgramId[TriangleSetup]);
+    glUniformMatrix4fv(0, 1, GL_FALSE, &g_LightViewMatrix[0][0]);
+    glUniform1ui(4, g_NumSceneTriangles);
+    glDispatchCompute((g_NumSceneTriangles + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void readVisibilityMap(std::vector<glm::vec4>& samples)
+{
+    const GLsizei num_pixels = Variables::WindowSize.x * Variables::WindowSize.y;
+    samples.resize(num_pixels);
+    if (g_VisibilityEncoding == VisibilityPositions)
+    {
+        glGetTextureImage(g_Textures[VisibilityMap], 0, GL_RGBA, GL_FLOAT, num_pixels * sizeof(glm::vec4), &samples[0]);
+        return;
+    }
+    if (g_VisibilityEncoding == VisibilityHalf)
+    {
+        std::vector<glm::hvec4> half_samples(num_pixels);
+        glGetTextureImage(g_Textures[VisibilityMap], 0, GL_RGBA, GL_HALF_FLOAT, num_pixels * sizeof(glm::hvec4), &half_samples[0]);
+        for (GLsizei i = 0; i < num_pixels; i++)
+            samples[i] = glm::vec4(half_samples[i].x.toFloat(), half_samples[i].y.toFloat(), half_samples[i].z.toFloat(), half_samples[i].w.toFloat());
+        return;
+    }
+    if (g_VisibilityEncoding == VisibilityDepth)
+    {
+        // Same unprojection as fetchCameraSample() of the shaders
+        std::vector<GLfloat> depths(num_pixels);
+        glGetTextureImage(g_Textures[VisibilityMap], 0, GL_RED, GL_FLOAT, num_pixels * sizeof(GLfloat), &depths[0]);
+        const glm::mat4 camera_to_light    = g_LightViewMatrix * glm::inverse(g_CameraViewMatrix);
+        const glm::mat4 inverse_projection = glm::inverse(g_CameraProjectionMatrix);
+        const glm::vec2 size               = glm::vec2(Variables::WindowSize);
+        for (GLsizei i = 0; i < num_pixels; i++)
+        {
+            if (depths[i] == 0.0f)
+            {
+                samples[i] = glm::vec4(0.0f);
+                continue;
+            }
+            const glm::vec2 ndc = (glm::vec2(i % Variables::WindowSize.x, i / Variables::WindowSize.x) + 0.5f) / size * 2.0f - 1.0f;
+            const glm::vec4 ray = inverse_projection * glm::vec4(ndc, 1.0f, 1.0f);
+            samples[i] = camera_to_light * glm::vec4(glm::vec3(ray) * (depths[i] / -ray.z), 1.0f);
+        }
+        return;
+    }
+
+    // Visibility buffer resolved by the captured triangles, the same interpolation as fetchCameraSample() of the shaders
+    std::vector<glm::uvec2> items(num_pixels);
+    glGetTextureImage(g_Textures[VisibilityMap], 0, GL_RG_INTEGER, GL_UNSIGNED_INT, num_pixels * sizeof(glm::uvec2), &items[0]);
+    if (g_SceneTriangles.size() != 3 * g_NumSceneTriangles)
+    {
+        g_SceneTriangles.resize(3 * g_NumSceneTriangles);
+        if (g_NumSceneTriangles > 0)
+            glGetNamedBufferSubData(g_SceneTriangleBuffer, 0, g_SceneTriangles.size() * sizeof(glm::vec3), &g_SceneTriangles[0]);
+    }
+    for (GLsizei i = 0; i < num_pixels; i++)
+    {
+        const GLuint triangle = items[i].x - 1;
+        if ((items[i].x == 0) || (triangle >= g_NumSceneTriangles))
+        {
+            samples[i] = glm::vec4(0.0f);
+            continue;
+        }
+        glm::vec3 v[3];
+        for (int k = 0; k < 3; k++)
+            v[k] = glm::vec3(g_LightViewMatrix * glm::vec4(g_SceneTriangles[3 * triangle + k], 1.0f));
+        const glm::vec2 b = glm::vec2(items[i].y & 0xFFFFu, items[i].y >> 16) / 65535.0f;
+        samples[i] = glm::vec4(v[0] + b.x * (v[1] - v[0]) + b.y * (v[2] - v[0]), 1.0f);
+    }
+}
+
+void setVisibilityEncoding()
+{
+    // Depth samples are unprojected by the camera of the frame to the stored light view space (the main light)
+    const glm::mat4 camera_to_light    = g_VisibilityLightView * glm::inverse(g_CameraViewMatrix);
+    const glm::mat4 inverse_projection = glm::inverse(g_CameraProjectionMatrix);
+    glUniform1i(11, g_VisibilityEncoding);
+    glUniformMatrix4fv(12, 1, GL_FALSE, &camera_to_light[0][0]);
+    glUniformMatrix4fv(16, 1, GL_FALSE, &inverse_projection[0][0]);
+}
+
+void setPackedShadows()
+{
+    const GLint tiles_x = (Variables::WindowSize.x + SHADOW_TILE_WIDTH - 1) / SHADOW_TILE_WIDTH;
+    const GLint tiles_y = (Variables::WindowSize.y + SHADOW_TILE_HEIGHT - 1) / SHADOW_TILE_HEIGHT;
+    glUniform1i(20, g_PackedShadows);
+    glUniform1i(21, tiles_x);
+    glUniform1i(22, tiles_x * tiles_y);
+}
+
+void readShadowMap(std::vector<GLuint>& shadowed)
+{
+    const GLsizei num_pixels = Variables::WindowSize.x * Variables::WindowSize.y;
+    shadowed.resize(num_pixels);
+    if (!g_PackedShadows)
+    {
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glGetTextureImage(g_Textures[ShadowMap], 0, GL_RED_INTEGER, GL_UNSIGNED_INT, num_pixels * sizeof(GLuint), &shadowed[0]);
+        for (GLsizei i = 0; i < num_pixels; i++)
+            shadowed[i] = (shadowed[i] == g_Generation) ? 1 : 0;
+        return;
+    }
+
+    const GLint tiles_x = (Variables::WindowSize.x + SHADOW_TILE_WIDTH - 1) / SHADOW_TILE_WIDTH;
+    const GLint tiles_y = (Variables::WindowSize.y + SHADOW_TILE_HEIGHT - 1) / SHADOW_TILE_HEIGHT;
+    std::vector<GLuint> bits(tiles_x * tiles_y);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glGetNamedBufferSubData(g_ShadowBitBuffer, 0, bits.size() * sizeof(GLuint), &bits[0]);
+    for (GLsizei i = 0; i < num_pixels; i++)
+    {
+        const GLint x = i % Variables::WindowSize.x, y = i / Variables::WindowSize.x;
+        const GLuint word = bits[(y / SHADOW_TILE_HEIGHT) * tiles_x + x / SHADOW_TILE_WIDTH];
+        shadowed[i] = (word >> ((y % SHADOW_TILE_HEIGHT) * SHADOW_TILE_WIDTH + x % SHADOW_TILE_WIDTH)) & 1u;
+    }
+}
+
+void initCPUEngine()
+{
+    if (!g_CPUEngine)
+    {
+        g_CPUEngine = new AliasFreeCPU::Engine();
+        captureSceneTriangles();
+        g_SceneTriangles.resize(3 * g_NumSceneTriangles);
+        if (g_NumSceneTriangles > 0)
+            glGetNamedBufferSubData(g_SceneTriangleBuffer, 0, g_SceneTriangles.size() * sizeof(glm::vec3), &g_SceneTriangles[0]);
+        g_CPUEngine->setScene(g_SceneTriangles);
+    }
+
+    // The GPU shadow test is conservative, with NV_conservative_raster or the enlarged triangles of its shaders
+    g_CPUEngine->setConservative(true);
+    g_CPUEngine->setEdgeFunctions(g_EdgeFunctions);
+}
+
+void measureEncodingError()
+{
+    const GLsizei num_pixels = Variables::WindowSize.x * Variables::WindowSize.y;
+    std::vector<glm::vec4> samples, reference(num_pixels);
+    readVisibilityMap(samples);
+    glGetTextureImage(g_Textures[VisibilityReference], 0, GL_RGBA, GL_FLOAT, num_pixels * sizeof(glm::vec4), &reference[0]);
+
+    // Both sample sets run through the same lists and shadow test of the current light frustum
+    initCPUEngine();
+    std::vector<GLuint> shadow_maps[2];
+    const std::vector<glm::vec4>* sample_sets[2] = { &samples, &reference };
+    for (int k = 0; k < 2; k++)
+    {
+        g_CPUEngine->setVisibilityMap(*sample_sets[k], Variables::WindowSize);
+        g_CPUEngine->buildLists(g_LightProjectionMatrix, g_Resolution);
+        g_CPUEngine->shadowTest(g_LightViewMatrix, g_LightProjectionMatrix);
+        g_CPUEngine->resolveShadows();
+        shadow_maps[k] = g_CPUEngine->getShadowMap();
+    }
+
+    g_EncodingErrorStats = {};
+    double error_sum = 0.0;
+    for (GLsizei i = 0; i < num_pixels; i++)
+    {
+        if (reference[i].w != 1.0f)
+            continue;
+        const float error = glm::length(glm::vec3(samples[i]) - glm::vec3(reference[i]));
+        g_EncodingErrorStats.samples++;
+        g_EncodingErrorStats.misclassified += ((shadow_maps[0][i] > 0) != (shadow_maps[1][i] > 0)) ? 1 : 0;
+        g_EncodingErrorStats.max_error      = glm::max(g_EncodingErrorStats.max_error, error);
+        error_sum += error;
+    }
+    if (g_EncodingErrorStats.samples > 0)
+        g_EncodingErrorStats.mean_error = float(error_sum / g_EncodingErrorStats.samples);
+}
+
+void shadowTestCPU()
+{
+    initCPUEngine();
+
+    const GLsizei num_pixels = Variables::WindowSize.x * Variables::WindowSize.y;
+    auto runPasses = [](bool gpu_samples)
+    {
+        if (gpu_samples)
+        {
+            std::vector<glm::vec4> samples;
+            readVisibilityMap(samples);
+            g_CPUEngine->setVisibilityMap(samples, Variables::WindowSize);
+        }
+        else
+        {
+            g_CPUEngine->generateVisibilityMap(g_CameraViewMatrix, g_CameraProjectionMatrix, Variables::WindowSize, g_LightViewMatrix);
+        }
+        g_CPUEngine->buildLists(g_LightProjectionMatrix, g_Resolution);
+        g_CPUEngine->shadowTest(g_LightViewMatrix, g_LightProjectionMatrix);
+        g_CPUEngine->resolveShadows();
+    };
+
+    std::vector<GLuint> gpu_shadow_map;
+    auto countMismatches = [&gpu_shadow_map, num_pixels](const std::vector<GLuint>& shadow_map)
+    {
+        GLuint mismatches = 0;
+        for (GLsizei i = 0; i < num_pixels; i++)
+            mismatches += ((gpu_shadow_map[i] > 0) != (shadow_map[i] > 0)) ? 1 : 0;
+        return mismatches;
+    };
+
+    // The passes 2 - 4 are checked on the GPU samples first, the statistics are of the last run
+    if (g_CPUCompare)
+    {
+        readShadowMap(gpu_shadow_map);
+        if (!g_CPUUseGPUSamples)
+        {
+            runPasses(true);
+            g_CPUPassMismatches = countMismatches(g_CPUEngine->getShadowMap());
+        }
+    }
+    runPasses(g_CPUUseGPUSamples);
+
+    const std::vector<GLuint>& shadow_map = g_CPUEngine->getShadowMap();
+    if (g_CPUCompare)
+    {
+        g_CPUMismatches    = countMismatches(shadow_map);
+        const GLuint samples = g_CPUEngine->getStatistics().samples;
+        const bool   half    = (g_VisibilityEncoding == VisibilityHalf);
+        g_CPUPassMismatchBound = half ? GLuint(samples * CPU_HALF_TIE_TOLERANCE) : 0;
+        g_CPUMismatchBound     = g_CPUUseGPUSamples ? g_CPUPassMismatchBound :
+                                 GLuint(samples * (half ? CPU_HALF_MISMATCH_TOLERANCE : CPU_MISMATCH_TOLERANCE));
+        if (g_CPUUseGPUSamples)
+            g_CPUPassMismatches = g_CPUMismatches;
+
+        if ((g_CPUPassMismatches > g_CPUPassMismatchBound) || (g_CPUMismatches > g_CPUMismatchBound))
+        {
+            if (!g_CPUCompareFailed)
+                printf("CPU vs GPU comparison failed in frame %d: %u mismatches (bound %u), %u with the GPU samples (bound %u)\n",
+                       Statistic::Frame::ID, g_CPUMismatches, g_CPUMismatchBound, g_CPUPassMismatches, g_CPUPassMismatchBound);
+            g_CPUCompareFailed = true;
+        }
+    }
+
+    if (g_PackedShadows)
+    {
+        // Same bit layout as shadowWord() and shadowBit() of the shaders
+        const GLint tiles_x = (Variables::WindowSize.x + SHADOW_TILE_WIDTH - 1) / SHADOW_TILE_WIDTH;
+        const GLint tiles_y = (Variables::WindowSize.y + SHADOW_TILE_HEIGHT - 1) / SHADOW_TILE_HEIGHT;
+        std::vector<GLuint> bits(tiles_x * tiles_y, 0);
+        for (GLsizei i = 0; i < num_pixels; i++)
+        {
+            const GLint x = i % Variables::WindowSize.x, y = i / Variables::WindowSize.x;
+            if (shadow_map[i] > 0)
+                bits[(y / SHADOW_TILE_HEIGHT) * tiles_x + x / SHADOW_TILE_WIDTH] |= 1u << ((y % SHADOW_TILE_HEIGHT) * SHADOW_TILE_WIDTH + x % SHADOW_TILE_WIDTH);
+        }
+        glNamedBufferSubData(g_ShadowBitBuffer, 0, bits.size() * sizeof(GLuint), &bits[0]);
+        return;
+    }
+
+    // Shadowed texels are tagged by the current generation
+    std::vector<GLuint> tagged_shadow_map(num_pixels);
+    for (GLsizei i = 0; i < num_pixels; i++)
+        tagged_shadow_map[i] = (shadow_map[i] > 0) ? g_Generation : 0;
+    glTextureSubImage2D(g_Textures[ShadowMap], 0, 0, 0, Variables::WindowSize.x, Variables::WindowSize.y, GL_RED_INTEGER, GL_UNSIGNED_INT, &tagged_shadow_map[0]);
+}
+
+void depthPrepass(GLuint program)
+{
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_ModelViewMatrix"), 1, GL_FALSE, &g_CameraViewMatrix[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_ProjectionMatrix"), 1, GL_FALSE, &g_CameraProjectionMatrix[0][0]);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    Tools::DrawScene();
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+void countCoveredPixels()
+{
+    // Full-screen rectangle moved to the far plane passes the depth test GL_GREATER only over the scene
+    glUseProgram(g_ProgramId[CoveredPixels]);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_GREATER);
+    glDepthRange(1.0, 1.0);
+
+    g_CoveredPixels.start();
+    drawRectangle();
+    g_CoveredPixels.stop();
+
+    glDepthRange(0.0, 1.0);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void releaseGL()
+{
+    g_Profiler.release();
+    g_ShadowTestInvocations.release();
+    g_SceneInvocations.release();
+    g_CoveredPixels.release();
+    g_OccupiedTexels.release();
+    g_ListSamples.release();
+    g_ViewSampleReadback.release();
+    glDeleteBuffers(1, &g_LightViewBuffer);
+    glDeleteBuffers(1, &g_ViewSampleBuffer);
+    g_LightViewBuffer = g_ViewSampleBuffer = 0;
+    g_LightBoundsReadback.release();
+    g_ListStatisticsReadback.release();
+    g_RayTestCounterReadback.release();
+    glDeleteBuffers(1, &g_HeavyListBuffer);
+    g_HeavyListBuffer = 0;
+    glDeleteBuffers(1, &g_TriangleBuffer);
+    glDeleteBuffers(1, &g_SceneTriangleBuffer);
+    glDeleteBuffers(1, &g_SceneAttributeBuffer);
+    glDeleteTextures(1, &g_Textures[VisibilityReference]);
+    glDeleteTextures(1, &g_Textures[SceneNormals]);
+    g_Textures[VisibilityReference] = g_Textures[SceneNormals] = 0;
+    glDeleteBuffers(1, &g_ShadowBitBuffer);
+    g_ShadowBitBuffer = 0;
+    glDeleteVertexArrays(1, &g_EmptyVertexArray);
+    g_TriangleBuffer = g_SceneTriangleBuffer = g_SceneAttributeBuffer = g_EmptyVertexArray = 0;
+    if (g_ListStatisticsFile)
+        fclose(g_ListStatisticsFile);
+    g_ListStatisticsFile = nullptr;
+
+    delete g_CPUEngine;
+    g_CPUEngine = nullptr;
+}
+
 void initGL() {
 
     // Default scene distance
@@ -515,11 +2398,14 @@ void initGL() {
     glNamedBufferStorage(atomic_counter_buffer, sizeof(GLuint), NULL, GL_NONE);
     glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, atomic_counter_buffer);
 
-    glCreateQueries(GL_TIMESTAMP, 2, q);
-
     // Load shader program
     compileShaders();
 
+    if (!GLEW_NV_conservative_raster)
+        printf("GL_NV_conservative_raster is not supported, the alias-free shadow test enlarges the triangles by half a light texel instead\n");
+    if (!GLEW_ARB_shader_viewport_layer_array)
+        printf("GL_ARB_shader_viewport_layer_array is not supported, the vertex pulling shadow test of several light views runs the geometry shader instead\n");
+
 }
 
 void drawRectangle()
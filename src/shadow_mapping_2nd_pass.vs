@@ -12,6 +12,9 @@ out vec2 v_TexCoord;
 out vec4 v_Vertex;
 out vec4 v_LightSpacePos;
 
+// The depth prepass runs this shader too, the scene is then shaded with the depth test GL_EQUAL
+invariant gl_Position;
+
 uniform mat4  u_ModelViewMatrix;
 uniform mat4  u_ProjectionMatrix;
 uniform mat4  u_LightViewMatrix;		// Use these two matrixes to calculate vertex position in ...